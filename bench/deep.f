@@ -0,0 +1,6 @@
+# ops: 10000000
+# recursion 10000 deep, 1000 times: return stack traffic
+
+: down dup if 1 - down then ;
+: deep 0 begin 10000 down drop 1 + dup 1000 = until drop ;
+deep
@@ -0,0 +1,5 @@
+# ops: 2692537
+# calls of a doubly recursive word, each through docol and exit
+
+: fib dup 2 < if else dup 1 - fib swap 2 - fib + then ;
+30 fib drop
@@ -0,0 +1,5 @@
+# ops: 20000000
+# tight arithmetic loop: lit+, dup, lit, = and 0branch
+
+: loop 0 begin 1 + dup 20000000 = until drop ;
+loop
@@ -0,0 +1,87 @@
+#!/bin/sh
+# usage: bench/run.sh dir [benchmark...]
+#
+# Run each benchmark (bench/NAME.f, or generated in dir/gen) on the
+# engines of dir (ENGINES, default: every one but the profiler), RUNS
+# times each (default 3), and print one CSV line per benchmark and
+# engine with the best time. A benchmark declares its number of
+# operations with a "# ops: N" line; dispatches are counted once for
+# each benchmark by forth-prof, so dispatches_per_sec is the rate of
+# the threaded code the engine runs, whether it dispatches or not.
+
+set -e
+
+dir=$1
+shift
+ENGINES=${ENGINES:-"call switch direct fast jit"}
+RUNS=${RUNS:-3}
+gen=$dir/gen
+mkdir -p "$gen"
+
+# generated sources, kept across runs
+if [ ! -f "$gen/lookup.f" ]; then
+    awk 'BEGIN {
+	print "# ops: 1000000"
+	print "# lookups in a dictionary of 10000 more words"
+	for(i = 0; i < 10000; i++) print ": w" i " " i " ;"
+	srand(1)
+	for(i = 0; i < 500000; i++) print "w" int(rand() * 10000) " drop"
+    }' > "$gen/lookup.f"
+fi
+if [ ! -f "$gen/tokens.f" ]; then
+    awk 'BEGIN {
+	n = 0
+	line = "1 drop 22 drop 333 dup drop drop 4444 drop 55555 drop"
+	for(size = 0; size < 50 * 1024 * 1024; size += 2 * length(line) + 20) {
+	    print line " " line
+	    print "# a comment line"
+	    n += 24
+	}
+	print "# ops: " n
+	print "# tokenizer throughput on 50 MB: numbers, words and comments"
+    }' > "$gen/tokens.f"
+fi
+if [ ! -f "$gen/compile.f" ]; then
+    awk 'BEGIN {
+	print "# ops: 20000"
+	print "# compiling 20000 definitions, with control structures"
+	for(i = 0; i < 20000; i++)
+	    print ": c" i " dup if 1 + else 2 * then dup 3 + swap drop",
+		"begin 1 - dup 0 = until over over + swap drop 7 * ;"
+    }' > "$gen/compile.f"
+fi
+
+if [ $# -eq 0 ]; then
+    set -- $(ls bench/*.f "$gen"/*.f | sed 's|.*/||; s|\.f$||')
+fi
+
+now() { date +%s%N; }
+
+echo "benchmark,engine,ops,ns,ns_per_op,dispatches,dispatches_per_sec"
+for name in "$@"; do
+    src=bench/$name.f
+    [ -f "$src" ] || src=$gen/$name.f
+    ops=$(sed -n 's/^# ops: //p' "$src")
+
+    dispatches=$( (cat "$src"; echo .prof) | "$dir/forth-prof" \
+	| awk '/^word +calls/ { on = 1; next } on && NF == 5 { n += $2 } END { print n }')
+
+    for engine in $ENGINES; do
+	bin=$dir/forth-$engine
+	[ "$engine" = call ] && bin=$dir/forth
+
+	best=
+	run=0
+	while [ $run -lt "$RUNS" ]; do
+	    start=$(now)
+	    "$bin" < "$src" > /dev/null
+	    ns=$(( $(now) - start ))
+	    if [ -z "$best" ] || [ $ns -lt $best ]; then best=$ns; fi
+	    run=$((run + 1))
+	done
+
+	awk -v b="$name" -v e="$engine" -v ops="$ops" -v ns="$best" -v d="$dispatches" 'BEGIN {
+	    printf "%s,%s,%d,%d,%.2f,%d,%.0f\n", b, e, ops, ns, ns / ops, d, d / (ns / 1e9)
+	}'
+    done
+done
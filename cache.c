@@ -0,0 +1,264 @@
+#define _GNU_SOURCE // strndup
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "forth.h"
+
+/*
+  include PATH interprets a file, like run_file. When f->cache_dir is
+  set, the words the file defines are saved there as a segment: a copy
+  of the words array from here before the file to here after it, with
+  the pointers of the image format (see relocate_words), then the bits
+  of the cells that hold pointers (see write_pointers). Including the
+  file again, in this process or another one, copies the segment back
+  at here instead of reading and compiling the file.
+
+  A segment is keyed by the hash of the file and by the fingerprint of
+  the dictionary it was compiled against (the names, flags, offsets and
+  threads of the words, and inline-limit), so it is only ever used
+  where it was saved from, relative to the words array, and for words
+  that compiled the same way.
+
+  Only files that just define words are cached: one that pushes
+  numbers, or runs words other than : and immediate ones outside of
+  definitions (see f->effects), may have other effects, and is always
+  interpreted. Forks never use the cache.
+*/
+
+#define SEGMENT_MAGIC "FORTHSEG"
+#define SEGMENT_VERSION 2
+
+typedef struct
+{
+    char magic[8];
+    u64 version;
+    u64 nprimitives; // PRIM_COUNT of the saving forth
+    u64 source; // hash of the file
+    u64 dictionary; // fingerprint of the words before it
+    u64 base; // address of the words array when saved
+    u64 start; // offsets in the words array
+    u64 end;
+    u64 latest;
+    u64 fused; // by the file
+    u64 inlined;
+} segment_header_t;
+
+extern prim_t* const primitives[PRIM_COUNT];
+
+u64 hash_name(const char* name, size_t len);
+u64* codeword(u8* word);
+u8* wordtag(u8* word);
+u8 codeword_kind(u64* cw);
+void index_word(forth_t* f, u8* word);
+void relocate_words(forth_t* f, u8* start, u8* end, u8* old, size_t size);
+bool write_pointers(forth_t* f, FILE* file, u8* start, u8* end);
+bool read_pointers(forth_t* f, FILE* file, u8* start, u8* end);
+bool jit_word(forth_t* f, u8* word, u8* end);
+void input_failure(forth_t* f, source_t* src);
+const char* next_token(source_t* src, size_t* len);
+
+static u64 mix(u64 h, u64 v) { return (h ^ v) * 0x100000001b3; }
+
+// a hash of the words of f that does not depend on where they are
+// mapped: pointers to the words array count as offsets, and native
+// code as the thread it was compiled from
+static u64 fingerprint(forth_t* f)
+{
+    u64 h = mix(mix(mix(hash_name("", 0), PRIM_COUNT), f->inline_limit), f->radix);
+    h = mix(h, f->here - f->words);
+
+    u8* after = f->here;
+    for(u8* w = f->latest ; w ; after = w, w = *cast(u8**, w))
+    {
+	u64* cw = codeword(w);
+	u8 kind = codeword_kind(cw);
+	const char* name = cast(const char*, wordname(w));
+	h = mix(h, w - f->words);
+	h = mix(h, *wordtag(w));
+	h = mix(h, kind == NATIVE_KIND ? PRIM_DOCOL : kind);
+	h = mix(h, hash_name(name, strlen(name)));
+
+	for(u64* p = cw + 1 ; p < cast(u64*, after) ; ++p)
+	{
+	    u8* q = cast(u8*, *p);
+	    h = mix(h, q >= f->words && q < f->here ? cast(u64, q - f->words) : *p);
+	}
+    }
+    return h;
+}
+
+// the hash of the rest of file, which is rewound; false if unreadable
+static bool hash_file(FILE* file, u64* hash)
+{
+    size_t cap = 1 << 16, len = 0, n;
+    char* buf = malloc(cap);
+    while((n = fread(buf + len, 1, cap - len, file)) > 0)
+    {
+	len += n;
+	if(len == cap) buf = realloc(buf, cap *= 2);
+    }
+    bool ok = !ferror(file);
+    *hash = hash_name(buf, len);
+    free(buf);
+    rewind(file);
+    return ok;
+}
+
+// copy the segment at path, if it matches, to here
+static bool load_segment(forth_t* f, const char* path, const segment_header_t* key)
+{
+    FILE* file = fopen(path, "r");
+    if(!file) return false;
+
+    segment_header_t header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+	&& memcmp(header.magic, SEGMENT_MAGIC, 8) == 0
+	&& header.version == SEGMENT_VERSION
+	&& header.nprimitives == PRIM_COUNT
+	&& header.source == key->source
+	&& header.dictionary == key->dictionary
+	&& header.start == key->start
+	&& header.latest >= header.start && header.latest < header.end
+	&& header.end <= f->word_size
+	&& fread(f->here, 1, header.end - header.start, file) == header.end - header.start
+	&& read_pointers(f, file, f->here, f->words + header.end);
+    fclose(file);
+    if(!ok) return false;
+
+    u8* start = f->here;
+    f->here = f->words + header.end;
+    f->latest = f->words + header.latest;
+    f->fused += header.fused;
+    f->inlined += header.inlined;
+    relocate_words(f, start, f->here, cast(u8*, header.base), header.end);
+
+    // then as if the words were defined again, oldest first
+    size_t count = 0;
+    for(u8* w = f->latest ; w >= start ; w = *cast(u8**, w)) count++;
+    f->word_count += count;
+    u8** words = malloc(count * sizeof(u8*));
+    size_t i = count;
+    for(u8* w = f->latest ; w >= start ; w = *cast(u8**, w)) words[--i] = w;
+
+    for(i = 0 ; i < count ; ++i)
+    {
+	u64* cw = codeword(words[i]);
+	*cw = cast(u64, primitives[codeword_kind(cw)]);
+	index_word(f, words[i]);
+	if(codeword_kind(cw) == PRIM_DOCOL)
+	    jit_word(f, words[i], i + 1 < count ? words[i + 1] : f->here);
+    }
+    free(words);
+    return true;
+}
+
+// save the words from start to here at path, atomically
+static void save_segment(forth_t* f, const char* path, segment_header_t* header, u8* start)
+{
+    for(u8* w = f->latest ; w >= start ; w = *cast(u8**, w))
+	if(codeword_kind(codeword(w)) == PRIM_NONE) return;
+
+    char* tmp = malloc(strlen(path) + 32);
+    sprintf(tmp, "%s.%ld", path, cast(long, getpid()));
+    FILE* file = fopen(tmp, "w");
+    if(!file)
+    {
+	free(tmp);
+	return;
+    }
+
+    header->base = cast(u64, f->words);
+    header->end = f->here - f->words;
+    header->latest = f->latest - f->words;
+    fwrite(header, sizeof(*header), 1, file);
+    fwrite(start, 1, f->here - start, file);
+
+    // like save_image, native code is compiled again when loading
+    for(u8* w = f->latest ; w >= start ; w = *cast(u8**, w))
+    {
+	u8* kind = cast(u8*, codeword(w)) - 1;
+	if(*kind != NATIVE_KIND) continue;
+	fseek(file, sizeof(*header) + (kind - start), SEEK_SET);
+	fputc(PRIM_DOCOL, file);
+    }
+    fseek(file, 0, SEEK_END);
+    write_pointers(f, file, start, f->here);
+
+    if(fclose(file) == 0) rename(tmp, path);
+    else remove(tmp);
+    free(tmp);
+}
+
+int include_file(forth_t* f, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if(!file) return -1;
+
+    segment_header_t header = {
+	.magic = SEGMENT_MAGIC,
+	.version = SEGMENT_VERSION,
+	.nprimitives = PRIM_COUNT,
+	.start = f->here - f->words,
+    };
+    char* segment = NULL;
+    if(f->cache_dir && !f->base && hash_file(file, &header.source))
+    {
+	header.dictionary = fingerprint(f);
+	segment = malloc(strlen(f->cache_dir) + 48);
+	sprintf(segment, "%s/%016llx-%016llx.seg", f->cache_dir,
+		cast(unsigned long long, header.source),
+		cast(unsigned long long, header.dictionary));
+	if(load_segment(f, segment, &header))
+	{
+	    free(segment);
+	    fclose(file);
+	    return 0;
+	}
+    }
+
+    u8* start = f->here;
+    u64 effects = f->effects, depth = stack_size(f);
+    u64 fused = f->fused, inlined = f->inlined;
+
+    int status = run_file(f, file);
+    fclose(file);
+
+    if(segment && status == 0 && f->effects == effects && stack_size(f) == depth
+       && f->latest && f->latest >= start)
+    {
+	header.fused = f->fused - fused;
+	header.inlined = f->inlined - inlined;
+	if(mkdir(f->cache_dir, 0777) == 0 || errno == EEXIST)
+	    save_segment(f, segment, &header, start);
+    }
+    free(segment);
+    return status;
+}
+
+void include(forth_t* f)
+{
+    size_t len;
+    const char* token = next_token(f->input, &len);
+    if(!token)
+    {
+	input_failure(f, f->input);
+	forth_error(f, NULL);
+    }
+    char* path = strndup(token, len);
+
+    // the file is run by a nested inner interpreter
+    u64* next = f->next;
+    u64* current = f->current;
+    int status = include_file(f, path);
+    f->next = next;
+    f->current = current;
+
+    if(status < 0) print(f, "[cannot include %s]\n", path);
+    free(path);
+    if(status != 0) forth_error(f, NULL);
+}
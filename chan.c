@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+/*
+  Channels: bounded lock-free queues of cells, between forths running
+  on any threads. chan-new ( capacity -- chan ) makes one for any
+  number of senders and receivers, chan-new-spsc ( capacity -- chan )
+  one for a single sender and a single receiver, which is cheaper. The
+  capacity is rounded up to a power of 2, and to 2 for chan-new (the
+  sequence numbers cannot tell a full slot from a free one in a queue
+  of 1).
+
+  chan-send ( x chan -- ) and chan-recv ( chan -- x ) wait for room or
+  a cell, chan-try-recv ( chan -- x 1 | 0 ) does not, and chan-send-n
+  and chan-recv-n ( addr n chan -- ) move n cells from or to memory,
+  claiming as many slots as they can at once. chan-free ( chan -- )
+  frees a channel nobody uses anymore.
+
+  The spsc queue is a ring with the index of the next cell to receive
+  (head) and to send (tail), each written by one side only. The other
+  one is the bounded queue of D. Vyukov: each slot has a sequence
+  number, which tells whether it holds the cell of a given position,
+  and both sides claim positions with a compare and swap.
+
+  While waiting, a forth spins a little, then starts a task queued in
+  its pool on a coroutine (see help_pool_later) and lets its other
+  coroutines run (see coro_yield), as the other side may be either of
+  them; only when there is none does it yield the CPU, then sleep, then
+  tell its pool (see block_pool) that it may need one more worker.
+*/
+
+typedef struct chan_t
+{
+    size_t head __attribute__((aligned(64))); // next position to receive
+    size_t tail __attribute__((aligned(64))); // next position to send
+    size_t mask __attribute__((aligned(64))); // capacity - 1
+    bool spsc;
+    u64* cells;
+    size_t* seqs; // of each slot, NULL for spsc
+} chan_t;
+
+void block_pool(forth_t* f);
+bool help_pool_later(forth_t* f);
+bool coro_yield(forth_t* f);
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define RELAXED(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+static chan_t* new_chan(size_t capacity, bool spsc)
+{
+    size_t cap = spsc ? 1 : 2;
+    while(cap < capacity) cap *= 2;
+
+    chan_t* c;
+    if(posix_memalign(cast(void**, &c), 64, sizeof(chan_t)) != 0) return NULL;
+    memset(c, 0, sizeof(chan_t));
+    c->mask = cap - 1;
+    c->spsc = spsc;
+    c->cells = malloc(cap * sizeof(u64));
+    if(!spsc)
+    {
+	c->seqs = malloc(cap * sizeof(size_t));
+	for(size_t i = 0 ; i < cap ; ++i) c->seqs[i] = i;
+    }
+    return c;
+}
+
+// send up to n cells from src, returns how many
+static size_t send_some(chan_t* c, const u64* src, size_t n)
+{
+    if(c->spsc)
+    {
+	size_t tail = RELAXED(&c->tail);
+	size_t room = c->mask + 1 - (tail - LOAD(&c->head));
+	size_t k = n < room ? n : room;
+	for(size_t i = 0 ; i < k ; ++i) c->cells[(tail + i) & c->mask] = src[i];
+	STORE(&c->tail, tail + k);
+	return k;
+    }
+
+    while(true)
+    {
+	size_t pos = RELAXED(&c->tail);
+	size_t k = 0;
+	while(k < n && k <= c->mask && LOAD(&c->seqs[(pos + k) & c->mask]) == pos + k) k++;
+	if(k == 0)
+	{
+	    // full, unless pos is stale
+	    if(LOAD(&c->seqs[pos & c->mask]) < pos) return 0;
+	    continue;
+	}
+	if(!__atomic_compare_exchange_n(&c->tail, &pos, pos + k, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	    continue;
+
+	for(size_t i = 0 ; i < k ; ++i)
+	{
+	    c->cells[(pos + i) & c->mask] = src[i];
+	    STORE(&c->seqs[(pos + i) & c->mask], pos + i + 1);
+	}
+	return k;
+    }
+}
+
+// receive up to n cells to dst, returns how many
+static size_t recv_some(chan_t* c, u64* dst, size_t n)
+{
+    if(c->spsc)
+    {
+	size_t head = RELAXED(&c->head);
+	size_t ready = LOAD(&c->tail) - head;
+	size_t k = n < ready ? n : ready;
+	for(size_t i = 0 ; i < k ; ++i) dst[i] = c->cells[(head + i) & c->mask];
+	STORE(&c->head, head + k);
+	return k;
+    }
+
+    while(true)
+    {
+	size_t pos = RELAXED(&c->head);
+	size_t k = 0;
+	while(k < n && k <= c->mask && LOAD(&c->seqs[(pos + k) & c->mask]) == pos + k + 1) k++;
+	if(k == 0)
+	{
+	    // empty, unless pos is stale
+	    if(LOAD(&c->seqs[pos & c->mask]) < pos + 1) return 0;
+	    continue;
+	}
+	if(!__atomic_compare_exchange_n(&c->head, &pos, pos + k, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	    continue;
+
+	for(size_t i = 0 ; i < k ; ++i)
+	{
+	    dst[i] = c->cells[(pos + i) & c->mask];
+	    STORE(&c->seqs[(pos + i) & c->mask], pos + i + c->mask + 1);
+	}
+	return k;
+    }
+}
+
+// called each time the channel is not ready, with the number of
+// previous calls since it last was
+static void wait_chan(forth_t* f, size_t tries)
+{
+    if(tries < 64) cpu_relax();
+    else if(help_pool_later(f) | coro_yield(f)) return;
+    else if(tries < 128) sched_yield();
+    else
+    {
+	block_pool(f); // again each time, tasks may have been queued since
+	struct timespec t = { 0, 50000 };
+	nanosleep(&t, NULL);
+    }
+}
+
+static void send_all(forth_t* f, chan_t* c, const u64* src, size_t n)
+{
+    for(size_t tries = 0 ; n > 0 ; )
+    {
+	size_t k = send_some(c, src, n);
+	src += k;
+	n -= k;
+	if(k) tries = 0;
+	else wait_chan(f, tries++);
+    }
+}
+
+static void recv_all(forth_t* f, chan_t* c, u64* dst, size_t n)
+{
+    for(size_t tries = 0 ; n > 0 ; )
+    {
+	size_t k = recv_some(c, dst, n);
+	dst += k;
+	n -= k;
+	if(k) tries = 0;
+	else wait_chan(f, tries++);
+    }
+}
+
+void chan_new(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    push(f, cast(u64, new_chan(pop(f), false)));
+}
+
+void chan_new_spsc(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    push(f, cast(u64, new_chan(pop(f), true)));
+}
+
+void chan_free(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    chan_t* c = cast(chan_t*, pop(f));
+    free(c->cells);
+    free(c->seqs);
+    free(c);
+}
+
+void chan_send(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    chan_t* c = cast(chan_t*, pop(f));
+    u64 x = pop(f);
+    send_all(f, c, &x, 1);
+}
+
+void chan_recv(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    chan_t* c = cast(chan_t*, pop(f));
+    u64 x;
+    recv_all(f, c, &x, 1);
+    push(f, x);
+}
+
+void chan_try_recv(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    chan_t* c = cast(chan_t*, pop(f));
+    u64 x;
+    if(recv_some(c, &x, 1) == 0)
+    {
+	push(f, 0);
+	return;
+    }
+    push(f, x);
+    push(f, 1);
+}
+
+void chan_send_n(forth_t* f)
+{
+    check(stack_size(f) >= 3);
+    chan_t* c = cast(chan_t*, pop(f));
+    u64 n = pop(f);
+    send_all(f, c, cast(const u64*, pop(f)), n);
+}
+
+void chan_recv_n(forth_t* f)
+{
+    check(stack_size(f) >= 3);
+    chan_t* c = cast(chan_t*, pop(f));
+    u64 n = pop(f);
+    recv_all(f, c, cast(u64*, pop(f)), n);
+}
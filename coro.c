@@ -0,0 +1,389 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+/*
+  Coroutines, all running on the thread of their forth, one at a time:
+  task ( x1 .. xn n xt -- ) makes one that runs xt on the stack x1 ..
+  xn (what it leaves there at the end is dropped), and yield ( -- )
+  lets the next one that can run do so, the interpreter itself being
+  one of them. run-tasks ( -- ) yields until the others are done.
+
+  Each coroutine has stacks of its own (data, return and C), and its
+  own input source and word buffer: a switch saves the fields of f
+  they live in (see coro_state_t), and the callee-saved registers on
+  the C stack it leaves. So the threads, native code and C primitives
+  being run are simply resumed where they were.
+
+  The coroutines that can run are queued, in order. One waiting for
+  I/O (see io.c, and refill for the input) blocks until the completion
+  of its operation wakes it, and when none can run, the event loop
+  (see switch_next) waits for a completion. An error stops the
+  coroutine it happens in only.
+*/
+
+// of each coroutine, but the interpreter's (which uses the ones of f)
+#define CORO_STACK_CELLS 4096
+#define CORO_RSTACK_CELLS 4096
+#define CORO_C_STACK (1ul << 20)
+
+u8* new_region(size_t size, void* hint);
+void free_region(u8* region, size_t size);
+u64* new_stack(size_t n);
+void free_stack(u64* stack, size_t n);
+
+// the fields of f that are per coroutine
+typedef struct
+{
+    u64* stack;
+    u64* rstack;
+    size_t stack_size;
+    size_t rstack_size;
+    u64* top_stack;
+    u64* top_rstack;
+    u64* next;
+    u64* current;
+    FILE* input_stream;
+    source_t* input;
+    char* word_buf;
+    size_t word_cap;
+    jmp_buf* on_error;
+} coro_state_t;
+
+typedef struct coro_t
+{
+    void* sp; // saved C stack pointer, while switched out
+    u8* cstack; // NULL for the interpreter
+    coro_state_t state; // while switched out
+
+    struct coros_t* coros;
+    u64* xt;
+    void (*fn)(forth_t*, void*); // run in place of xt, if any
+    void* arg;
+    bool done;
+    struct coro_t* next; // ring of the coroutines of a forth
+    struct coro_t* prev;
+    struct coro_t* queued; // next one that can run
+} coro_t;
+
+typedef struct coros_t
+{
+    forth_t* f;
+    coro_t main; // the interpreter, which made the others
+    coro_t* running;
+    size_t count; // coroutines in the ring, but main
+    coro_t* dead; // to free, once switched away from
+    coro_t* first; // queue of the ones that can run
+    coro_t* last;
+    coro_t* joiner; // in run-tasks
+} coros_t;
+
+bool io_wait(forth_t* f, bool block);
+
+static void save_state(forth_t* f, coro_state_t* s)
+{
+    *s = (coro_state_t) {
+	f->stack, f->rstack, f->stack_size, f->rstack_size,
+	f->top_stack, f->top_rstack, f->next, f->current,
+	f->input_stream, f->input, f->word_buf, f->word_cap, f->on_error,
+    };
+}
+
+static void load_state(forth_t* f, const coro_state_t* s)
+{
+    f->stack = s->stack;
+    f->rstack = s->rstack;
+    f->stack_size = s->stack_size;
+    f->rstack_size = s->rstack_size;
+    f->top_stack = s->top_stack;
+    f->top_rstack = s->top_rstack;
+    f->next = s->next;
+    f->current = s->current;
+    f->input_stream = s->input_stream;
+    f->input = s->input;
+    f->word_buf = s->word_buf;
+    f->word_cap = s->word_cap;
+    f->on_error = s->on_error;
+}
+
+static void coro_main(coro_t* c);
+
+#if defined(__x86_64__)
+
+/*
+  switch_stack(from, to) saves the callee-saved registers on the
+  current stack and its pointer in *from, then returns on the stack at
+  to. A new stack returns to coro_start, with the coroutine in r12.
+*/
+void switch_stack(void** from, void* to);
+void coro_start(void);
+
+__asm__(
+    ".text\n"
+    ".globl switch_stack\n"
+    ".type switch_stack, @function\n"
+    "switch_stack:\n"
+    "  push %rbp\n  push %rbx\n  push %r12\n  push %r13\n  push %r14\n  push %r15\n"
+    "  mov %rsp, (%rdi)\n"
+    "  mov %rsi, %rsp\n"
+    "  pop %r15\n  pop %r14\n  pop %r13\n  pop %r12\n  pop %rbx\n  pop %rbp\n"
+    "  ret\n"
+    ".size switch_stack, .-switch_stack\n"
+    ".globl coro_start\n"
+    ".type coro_start, @function\n"
+    "coro_start:\n"
+    "  mov %r12, %rdi\n"
+    "  call coro_entry\n"
+    "  ud2\n"
+    ".size coro_start, .-coro_start\n");
+
+__attribute__((used)) void coro_entry(coro_t* c) { coro_main(c); }
+
+// the stack that switch_stack returns to the first time
+static void* first_stack(coro_t* c)
+{
+    u64* top = cast(u64*, cast(u64, c->cstack + CORO_C_STACK) & ~15ull);
+    u64* sp = top - 7;
+    memset(sp, 0, 7 * sizeof(u64));
+    sp[3] = cast(u64, c); // r12
+    sp[6] = cast(u64, coro_start);
+    return sp;
+}
+
+static void free_context(void* sp) { (void)sp; }
+
+#else
+
+// elsewhere, the contexts of ucontext.h take the place of the stacks
+#include <ucontext.h>
+
+static void switch_stack(void** from, void* to)
+{
+    if(!*from) *from = malloc(sizeof(ucontext_t)); // the interpreter's
+    swapcontext(*from, to);
+}
+
+static void coro_start(unsigned hi, unsigned lo)
+{
+    coro_main(cast(coro_t*, (cast(uintptr_t, hi) << 32) | lo));
+}
+
+static void* first_stack(coro_t* c)
+{
+    ucontext_t* uc = malloc(sizeof(ucontext_t));
+    getcontext(uc);
+    uc->uc_stack.ss_sp = c->cstack;
+    uc->uc_stack.ss_size = CORO_C_STACK;
+    uc->uc_link = NULL;
+    uintptr_t p = cast(uintptr_t, c);
+    makecontext(uc, cast(void (*)(void), coro_start), 2,
+		cast(unsigned, p >> 32), cast(unsigned, p));
+    return uc;
+}
+
+static void free_context(void* sp) { free(sp); }
+
+#endif
+
+static void free_coro(coro_t* c)
+{
+    free_stack(c->state.stack, c->state.stack_size);
+    free_stack(c->state.rstack, c->state.rstack_size);
+    free_region(c->cstack, CORO_C_STACK);
+    free_context(c->sp);
+    free(c->state.word_buf);
+    free(c);
+}
+
+// make the coroutine c run in place of the running one
+static void resume(coros_t* s, coro_t* c)
+{
+    coro_t* from = s->running;
+    if(c == from) return;
+
+    save_state(s->f, &from->state);
+    load_state(s->f, &c->state);
+    s->running = c;
+    switch_stack(&from->sp, c->sp);
+
+    // back in from, maybe from a coroutine that is done
+    if(s->dead)
+    {
+	s->dead->prev->next = s->dead->next;
+	s->dead->next->prev = s->dead->prev;
+	free_coro(s->dead);
+	s->dead = NULL;
+    }
+}
+
+static void enqueue(coros_t* s, coro_t* c)
+{
+    c->queued = NULL;
+    if(s->last) s->last->queued = c;
+    else s->first = c;
+    s->last = c;
+}
+
+/*
+  Switch to the first coroutine that can run, waiting for I/O to wake
+  one if there is none: the event loop. The running one must be
+  queued again, waiting for something that wakes it, or done.
+*/
+static void switch_next(coros_t* s)
+{
+    while(!s->first)
+    {
+	bool waits = io_wait(s->f, true);
+	assert(waits); // else nothing would ever wake the running one
+	(void)waits;
+    }
+
+    coro_t* c = s->first;
+    s->first = c->queued;
+    if(!s->first) s->last = NULL;
+    resume(s, c);
+}
+
+static void coro_main(coro_t* c)
+{
+    coros_t* s = c->coros;
+    forth_t* f = s->f;
+    jmp_buf env;
+
+    f->on_error = &env;
+    if(setjmp(env) == 0)
+    {
+	if(c->fn) c->fn(f, c->arg);
+	else run_codeword(f, c->xt);
+    }
+
+    c->done = true;
+    s->count--;
+    s->dead = c;
+    if(s->joiner && s->count == (s->joiner != &s->main))
+    {
+	enqueue(s, s->joiner);
+	s->joiner = NULL;
+    }
+    switch_next(s); // for good
+    abort();
+}
+
+static coros_t* get_coros(forth_t* f)
+{
+    if(f->coros) return f->coros;
+
+    coros_t* s = calloc(1, sizeof(coros_t));
+    s->f = f;
+    s->main.coros = s;
+    s->main.next = s->main.prev = &s->main;
+    s->running = &s->main;
+    f->coros = s;
+    return s;
+}
+
+// by free_forth, from the interpreter: coroutines not done are dropped
+void free_coros(forth_t* f)
+{
+    coros_t* s = f->coros;
+    if(!s) return;
+    assert(s->running == &s->main);
+
+    for(coro_t* c = s->main.next ; c != &s->main ; )
+    {
+	coro_t* dead = c;
+	c = c->next;
+	free_coro(dead);
+    }
+    free_context(s->main.sp);
+    free(s);
+    f->coros = NULL;
+}
+
+// for io.c: the running coroutine of f, blocked until coro_wake
+void* coro_running(forth_t* f) { return get_coros(f)->running; }
+void coro_block(forth_t* f) { switch_next(get_coros(f)); }
+void coro_wake(forth_t* f, void* c) { enqueue(f->coros, c); }
+
+// whether f runs other coroutines, which may run meanwhile
+bool coro_others(forth_t* f) { return f->coros && f->coros->count > 0; }
+
+// one more coroutine of f, queued to run, with the n cells on top of
+// the stack of f for its stack
+static coro_t* new_coro(forth_t* f, u64 n)
+{
+    coros_t* s = get_coros(f);
+    coro_t* c = calloc(1, sizeof(coro_t));
+    c->coros = s;
+    c->cstack = new_region(CORO_C_STACK, NULL);
+    c->sp = first_stack(c);
+
+    coro_state_t* st = &c->state;
+    st->stack_size = CORO_STACK_CELLS;
+    st->rstack_size = CORO_RSTACK_CELLS;
+    st->stack = new_stack(st->stack_size);
+    st->rstack = new_stack(st->rstack_size);
+    memcpy(st->stack, f->top_stack - n, n * sizeof(u64));
+    f->top_stack -= n;
+    st->top_stack = st->stack + n;
+    st->top_rstack = st->rstack;
+    st->input_stream = f->input_stream;
+    st->input = f->input;
+    st->word_cap = 64;
+    st->word_buf = malloc(st->word_cap);
+
+    // next of the running one, so it runs first
+    c->next = s->running->next;
+    c->prev = s->running;
+    c->next->prev = c;
+    s->running->next = c;
+    s->count++;
+    enqueue(s, c);
+    return c;
+}
+
+void task(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64* xt = cast(u64*, pop(f));
+    u64 n = pop(f);
+    check(stack_size(f) >= n && n <= CORO_STACK_CELLS);
+    new_coro(f, n)->xt = xt;
+}
+
+// for task.c: a coroutine of f that runs fn(f, arg), from the next yield
+void coro_call(forth_t* f, void (*fn)(forth_t*, void*), void* arg)
+{
+    coro_t* c = new_coro(f, 0);
+    c->fn = fn;
+    c->arg = arg;
+}
+
+// let the next coroutine that can run do so; false if there was none
+bool coro_yield(forth_t* f)
+{
+    coros_t* s = f->coros;
+    if(!s) return false;
+    io_wait(f, false); // so that the ones waiting for I/O get their turn
+    if(!s->first) return false;
+    enqueue(s, s->running);
+    switch_next(s);
+    return true;
+}
+
+void yield(forth_t* f) { coro_yield(f); }
+
+// ( -- ) until the other coroutines are done
+void run_tasks(forth_t* f)
+{
+    coros_t* s = f->coros;
+    if(!s || s->count == (s->running != &s->main)) return;
+    s->joiner = s->running;
+    switch_next(s);
+}
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+/*
+  Floating-point numbers are doubles, kept in cells (as their bits) on
+  the same stacks as integers; numbers written with a . or an exponent
+  are such literals (see parse_float). f+ f- f* f/ fsqrt compute, f= f<
+  compare, s>f and f>s convert (truncating), f. prints.
+
+  Arrays of doubles are given as an address and a number of elements:
+  v+ and v* ( a b dst n -- ) store the element-wise sum or product of
+  a and b to dst (which may be either of them), vsum ( a n -- x ) and
+  vdot ( a b n -- x ) reduce them. Each is a single loop in C, with
+  SSE2 or AVX2 kernels picked when first used (see VECTOR_KERNELS); the
+  reductions add in a different order than a loop over the cells
+  would, so their results may differ in the last bits.
+*/
+
+static double to_f(u64 x) { double d; memcpy(&d, &x, 8); return d; }
+static u64 from_f(double d) { u64 x; memcpy(&x, &d, 8); return x; }
+
+// the top two cells as doubles, a below b
+#define FBINARY(name, op)				\
+    void name(forth_t* f)				\
+    {							\
+	check(stack_size(f) >= 2);			\
+	double b = to_f(pop(f));			\
+	double a = to_f(pop(f));			\
+	push(f, from_f(a op b));			\
+    }
+
+FBINARY(fadd, +)
+FBINARY(fsub, -)
+FBINARY(fmult, *)
+FBINARY(fdiv, /)
+
+void feq(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    double b = to_f(pop(f));
+    double a = to_f(pop(f));
+    push(f, a == b);
+}
+
+void flt(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    double b = to_f(pop(f));
+    double a = to_f(pop(f));
+    push(f, a < b);
+}
+
+void dofsqrt(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    f->top_stack[-1] = from_f(sqrt(to_f(f->top_stack[-1])));
+}
+
+void int_to_float(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    f->top_stack[-1] = from_f(cast(i64, f->top_stack[-1]));
+}
+
+void float_to_int(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    f->top_stack[-1] = cast(u64, cast(i64, to_f(f->top_stack[-1])));
+}
+
+void printfloat(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    print(f, "%.15g ", to_f(pop(f)));
+}
+
+/*
+  txt (len chars) as a double: digits with a . or an exponent, e.g.
+  1.5, -.25 or 1e9, but not the words made of such chars (like 1+ or
+  .), nor nan, inf or hexadecimal ones.
+*/
+bool parse_float(const char* txt, size_t len, u64* bits)
+{
+    char buf[64];
+    if(len == 0 || len >= sizeof(buf)) return false;
+
+    bool digit = false, point = false;
+    for(size_t i = 0 ; i < len ; ++i)
+    {
+	char c = txt[i];
+	if(c >= '0' && c <= '9') digit = true;
+	else if(c == '.' || c == 'e' || c == 'E') point = true;
+	else if(c != '-' && c != '+') return false;
+    }
+    if(!digit || !point) return false;
+
+    memcpy(buf, txt, len);
+    buf[len] = '\0';
+    char* end;
+    double d = strtod(buf, &end);
+    if(end != buf + len) return false;
+    *bits = from_f(d);
+    return true;
+}
+
+static void add_scalar(const double* a, const double* b, double* dst, size_t n)
+{
+    for(size_t i = 0 ; i < n ; ++i) dst[i] = a[i] + b[i];
+}
+
+static void mult_scalar(const double* a, const double* b, double* dst, size_t n)
+{
+    for(size_t i = 0 ; i < n ; ++i) dst[i] = a[i] * b[i];
+}
+
+// with b NULL, the sum of a
+static double dot_scalar(const double* a, const double* b, size_t n)
+{
+    double s = 0;
+    for(size_t i = 0 ; i < n ; ++i) s += b ? a[i] * b[i] : a[i];
+    return s;
+}
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+/*
+  The kernels of an instruction set, W doubles at a time; the rest of
+  the elements is left to the scalar ones. The reductions keep 4
+  accumulators, to hide the latency of the additions.
+*/
+#define VECTOR_KERNELS(isa, suffix, vec, W, load, store, add, mul, zero, hsum) \
+    __attribute__((target(isa)))					\
+    static void add_##suffix(const double* a, const double* b, double* dst, size_t n) \
+    {									\
+	size_t i = 0;							\
+	for(; i + W <= n ; i += W) store(dst + i, add(load(a + i), load(b + i))); \
+	add_scalar(a + i, b + i, dst + i, n - i);			\
+    }									\
+									\
+    __attribute__((target(isa)))					\
+    static void mult_##suffix(const double* a, const double* b, double* dst, size_t n) \
+    {									\
+	size_t i = 0;							\
+	for(; i + W <= n ; i += W) store(dst + i, mul(load(a + i), load(b + i))); \
+	mult_scalar(a + i, b + i, dst + i, n - i);			\
+    }									\
+									\
+    __attribute__((target(isa)))					\
+    static double dot_##suffix(const double* a, const double* b, size_t n) \
+    {									\
+	vec s0 = zero(), s1 = zero(), s2 = zero(), s3 = zero();		\
+	size_t i = 0;							\
+	for(; i + 4 * W <= n ; i += 4 * W)				\
+	{								\
+	    vec x0 = load(a + i), x1 = load(a + i + W);		\
+	    vec x2 = load(a + i + 2 * W), x3 = load(a + i + 3 * W);	\
+	    if(b)							\
+	    {								\
+		x0 = mul(x0, load(b + i));				\
+		x1 = mul(x1, load(b + i + W));				\
+		x2 = mul(x2, load(b + i + 2 * W));			\
+		x3 = mul(x3, load(b + i + 3 * W));			\
+	    }								\
+	    s0 = add(s0, x0); s1 = add(s1, x1);				\
+	    s2 = add(s2, x2); s3 = add(s3, x3);				\
+	}								\
+	double s = hsum(add(add(s0, s1), add(s2, s3)));			\
+	return s + dot_scalar(a + i, b ? b + i : NULL, n - i);		\
+    }
+
+__attribute__((target("sse2")))
+static double hsum_sse2(__m128d v) { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+
+__attribute__((target("avx2")))
+static double hsum_avx2(__m256d v)
+{
+    return hsum_sse2(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1)));
+}
+
+VECTOR_KERNELS("sse2", sse2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+	       _mm_add_pd, _mm_mul_pd, _mm_setzero_pd, hsum_sse2)
+VECTOR_KERNELS("avx2", avx2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd,
+	       _mm256_add_pd, _mm256_mul_pd, _mm256_setzero_pd, hsum_avx2)
+
+static void add_any(const double* a, const double* b, double* dst, size_t n);
+static void mult_any(const double* a, const double* b, double* dst, size_t n);
+static double dot_any(const double* a, const double* b, size_t n);
+static void (*add_kernel)(const double*, const double*, double*, size_t) = add_any;
+static void (*mult_kernel)(const double*, const double*, double*, size_t) = mult_any;
+static double (*dot_kernel)(const double*, const double*, size_t) = dot_any;
+
+static void pick_kernels(void)
+{
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    add_kernel = avx2 ? add_avx2 : add_sse2;
+    mult_kernel = avx2 ? mult_avx2 : mult_sse2;
+    dot_kernel = avx2 ? dot_avx2 : dot_sse2;
+}
+
+static void add_any(const double* a, const double* b, double* dst, size_t n)
+{
+    pick_kernels();
+    add_kernel(a, b, dst, n);
+}
+
+static void mult_any(const double* a, const double* b, double* dst, size_t n)
+{
+    pick_kernels();
+    mult_kernel(a, b, dst, n);
+}
+
+static double dot_any(const double* a, const double* b, size_t n)
+{
+    pick_kernels();
+    return dot_kernel(a, b, n);
+}
+
+#else
+// elsewhere, the compiler vectorizes the loops (e.g. NEON on arm64)
+#define add_kernel add_scalar
+#define mult_kernel mult_scalar
+#define dot_kernel dot_scalar
+#endif
+
+void vadd(forth_t* f)
+{
+    check(stack_size(f) >= 4);
+    size_t n = pop(f);
+    double* dst = cast(double*, pop(f));
+    double* b = cast(double*, pop(f));
+    add_kernel(cast(double*, pop(f)), b, dst, n);
+}
+
+void vmult(forth_t* f)
+{
+    check(stack_size(f) >= 4);
+    size_t n = pop(f);
+    double* dst = cast(double*, pop(f));
+    double* b = cast(double*, pop(f));
+    mult_kernel(cast(double*, pop(f)), b, dst, n);
+}
+
+void vsum(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    size_t n = pop(f);
+    push(f, from_f(dot_kernel(cast(double*, pop(f)), NULL, n)));
+}
+
+void vdot(forth_t* f)
+{
+    check(stack_size(f) >= 3);
+    size_t n = pop(f);
+    double* b = cast(double*, pop(f));
+    push(f, from_f(dot_kernel(cast(double*, pop(f)), b, n)));
+}
@@ -0,0 +1,2553 @@
+#define _GNU_SOURCE // needed for fmemopen (string -> FILE*)
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+// the arrays are only reserved, so these cost nothing until used
+const forth_sizes_t default_sizes = {
+    .word_size = 1ul << 30,
+    .stack_size = 1ul << 20,
+    .rstack_size = 1ul << 16,
+};
+
+void dosave_image(forth_t* f);
+void index_word(forth_t* f, u8* word);
+u8* index_lookup(u8** index, size_t size, const char* name, size_t len);
+forth_t* share_forth(forth_t* base);
+u8 prim_id(prim_t* primitive);
+void fuse_thread(forth_t* f, u64* body);
+bool analyze_word(forth_t* f, u64* cw, size_t n);
+u8* effect_bytes(u64* cw);
+void stack_error(forth_t* f, u64* cw);
+size_t thread_length(forth_t* f, u64* body, u64* end);
+
+// see jit.c
+bool jit_word(forth_t* f, u8* word, u8* end);
+void jit_words(forth_t* f);
+void free_jit(forth_t* f);
+
+// see cache.c
+void include(forth_t* f);
+
+// see float.c
+void fadd(forth_t* f);
+void fsub(forth_t* f);
+void fmult(forth_t* f);
+void fdiv(forth_t* f);
+void dofsqrt(forth_t* f);
+void feq(forth_t* f);
+void flt(forth_t* f);
+void int_to_float(forth_t* f);
+void float_to_int(forth_t* f);
+void vadd(forth_t* f);
+void vmult(forth_t* f);
+void vsum(forth_t* f);
+void vdot(forth_t* f);
+void printfloat(forth_t* f);
+bool parse_float(const char* txt, size_t len, u64* bits);
+
+// see mem.c
+void cmove(forth_t* f);
+void fill(forth_t* f);
+void compare(forth_t* f);
+void search(forth_t* f);
+void arena_new(forth_t* f);
+void arena_alloc(forth_t* f);
+void arena_mark(forth_t* f);
+void arena_release(forth_t* f);
+void arena_reset(forth_t* f);
+void arena_free(forth_t* f);
+void free_arenas(forth_t* f);
+
+// see str.c
+void concat(forth_t* f);
+void slice(forth_t* f);
+void dohash(forth_t* f);
+void to_number(forth_t* f);
+void number_to_s(forth_t* f);
+
+// see task.c
+void spawn(forth_t* f);
+void join(forth_t* f);
+void free_pool(forth_t* f);
+
+// see chan.c
+void chan_new(forth_t* f);
+void chan_new_spsc(forth_t* f);
+void chan_send(forth_t* f);
+void chan_recv(forth_t* f);
+void chan_try_recv(forth_t* f);
+void chan_send_n(forth_t* f);
+void chan_recv_n(forth_t* f);
+void chan_free(forth_t* f);
+
+// see coro.c
+void task(forth_t* f);
+void yield(forth_t* f);
+void run_tasks(forth_t* f);
+void free_coros(forth_t* f);
+
+// see io.c
+void tcp_listen(forth_t* f);
+void tcp_connect(forth_t* f);
+void doaccept(forth_t* f);
+void read_async(forth_t* f);
+void write_async(forth_t* f);
+void close_fd(forth_t* f);
+void fd_stream(forth_t* f);
+void wait_input(forth_t* f, int fd, bool block);
+void free_io(forth_t* f);
+
+// see out.c
+void inherit_output(forth_t* f, forth_t* base);
+void free_output(forth_t* f);
+
+// see prof.c; the hooks are compiled out unless FORTH_PROFILE
+void prof_init(forth_t* f);
+void prof_free(forth_t* f);
+void prof_dispatch(forth_t* f, u64* cw);
+void prof_enter(forth_t* f, u64* cw);
+void prof_exit(forth_t* f);
+void printprof(forth_t* f);
+void resetprof(forth_t* f);
+
+// see stats.c
+extern __thread forth_t* running_forth;
+u64 now_ns(void);
+void count_io(forth_t* f, u64 start);
+void print_trace(forth_t* f);
+void stats_init(forth_t* f);
+void stats_free(forth_t* f);
+void stats_tick(forth_t* f);
+void printstats(forth_t* f);
+void dowrite_stats(forth_t* f);
+void dostats_every(forth_t* f);
+
+#ifdef FORTH_PROFILE
+#define PROF_DISPATCH(f, cw) prof_dispatch(f, cw)
+#define PROF_ENTER(f, cw) prof_enter(f, cw)
+#define PROF_EXIT(f) prof_exit(f)
+#else
+#define PROF_DISPATCH(f, cw) ((void)0)
+#define PROF_ENTER(f, cw) ((void)0)
+#define PROF_EXIT(f) ((void)0)
+#endif
+
+// stack manipulation: see forth.h
+
+/*
+  The cells of the dictionary that hold pointers to it as data, rather
+  than as parts of the threads that relocate_words decodes: a bit each
+  in f->pointers, set by , when what it compiles points to the words
+  array (the operand of a lit, a variable, a codeword compiled by
+  hand), and cleared by the other words that compile cells, or moved
+  along with them (see fuse_thread and inline_word). So relocate_words
+  can tell these from numbers. A cell written by ! keeps its bit.
+*/
+static size_t pointers_size(forth_t* f) { return (f->word_size / 8 + 63) / 64 * 8; }
+
+static inline bool is_pointer(forth_t* f, u64* cell)
+{
+    size_t i = (cast(u8*, cell) - f->words) / 8;
+    return (f->pointers[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void mark_cell(forth_t* f, u64* cell, bool pointer)
+{
+    size_t i = (cast(u8*, cell) - f->words) / 8;
+    if(pointer) f->pointers[i / 64] |= 1ull << (i % 64);
+    else f->pointers[i / 64] &= ~(1ull << (i % 64));
+}
+
+// clear the bits of the cells from start to end
+static void clear_cells(forth_t* f, u8* start, u8* end)
+{
+    for(u64* p = cast(u64*, start) ; p < cast(u64*, end) ; ++p) mark_cell(f, p, false);
+}
+
+/*
+  Whether depth cells cannot run the colon definition of codeword cw,
+  of a known stack effect. This check is the only one in the builds
+  without the checks of the primitives (FORTH_UNCHECKED or NDEBUG), and
+  it covers the whole body, callees included.
+*/
+static inline bool bad_entry(forth_t* f, u64* cw, size_t depth)
+{
+    u8* e = effect_bytes(cw);
+    return e[0] && (depth + 1 < e[0] || depth + e[2] > f->stack_size);
+}
+
+/*
+  Keep the peak depths of the stacks in f->stats, on entering the
+  colon definition of codeword cw (rather than at each push, which it
+  would slow down): its body, callees included, pushes up to e[2]
+  cells when its stack effect is known. The depths are also taken when
+  the metrics are read (see stats.c).
+*/
+static inline void note_peaks(forth_t* f, u64* cw)
+{
+    u8* e = effect_bytes(cw);
+    u64 depth = stack_size(f) + (e[0] ? e[2] : 0);
+    if(depth > f->stats.stack_peak) f->stats.stack_peak = depth;
+    if(rstack_size(f) > f->stats.rstack_peak) f->stats.rstack_peak = rstack_size(f);
+}
+
+// count and trace a call of codeword cw, see stats.c
+static inline void count_call(forth_t* f, u64* cw)
+{
+    u64 n = f->stats.calls++;
+    f->stats.trace[n % TRACE_SIZE] = cw;
+}
+
+void docol(forth_t* f)
+{
+    PROF_ENTER(f, f->current);
+    if(bad_entry(f, f->current, stack_size(f))) stack_error(f, f->current);
+    count_call(f, f->current);
+    rpush(f, cast(u64, f->next));
+    note_peaks(f, f->current);
+    f->next = f->current + 1;
+    // no need to set f->current, since it will be taken care of by
+    // the end of the interpret loop (i.e. NEXT in jonesforth)
+}
+
+void doexit(forth_t* f) { PROF_EXIT(f); f->next = cast(u64*, rpop(f)); }
+
+// tailcall cw: exit, then run cw from there, so that the return stack
+// does not grow (see fuse_thread)
+void tail_call(forth_t* f)
+{
+    u64* cw = cast(u64*, *f->next);
+    doexit(f);
+    f->current = cw;
+    (*cast(prim_t**, cw))(f);
+}
+
+void lit(forth_t* f)
+{
+    push(f, *f->next);
+    f->next += 1;
+}
+
+// ( -- addr len ) of the chars that follow the length in the thread
+void litstring(forth_t* f)
+{
+    u64 len = *f->next;
+    push(f, cast(u64, f->next + 1));
+    push(f, len);
+    f->next += 1 + (len + 7) / 8;
+}
+
+void branch(forth_t* f)
+{
+    i64 offset = *f->next; f->next++;
+    f->next += offset;
+}
+
+void zero_branch(forth_t* f)
+{
+    i64 offset = *f->next; f->next++;
+    if(pop(f) == 0) f->next += offset;
+}
+
+// superinstructions
+
+void lit_add(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    f->top_stack[-1] += *f->next;
+    f->next += 1;
+}
+
+void dup_zero_branch(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    i64 offset = *f->next; f->next++;
+    if(f->top_stack[-1] == 0) f->next += offset;
+}
+
+void nip(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64 a = pop(f);
+    f->top_stack[-1] = a;
+}
+
+void two_dup(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64 a = f->top_stack[-2];
+    u64 b = f->top_stack[-1];
+    push(f, a);
+    push(f, b);
+}
+
+void is_compiling(forth_t* f) { push(f, f->state); }
+
+void set_immediate_mode(forth_t* f) { f->state = NORMAL_STATE; }
+void set_compile_mode(forth_t* f) { f->state = COMPILE_STATE; }
+
+void doerror(forth_t* f)
+{
+    flush_output(f);
+    print_trace(f);
+    forth_error(f, NULL);
+}
+
+void dorun_word(forth_t* f) { f->next = cast(u64*, pop(f)); }
+
+void dostack_size(forth_t* f) { push(f, stack_size(f)); }
+
+// the value of c as a digit, 36 or more if it is not one
+static unsigned digit_value(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'z') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'Z') return c - 'A' + 10;
+    return 36;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/*
+  The value of the 8 decimal digits at p, or -1 if they are not all
+  digits: each step combines pairs of lanes, the first char being the
+  lowest byte.
+*/
+static i64 eight_digits(const char* p)
+{
+    u64 x;
+    memcpy(&x, p, 8);
+    if(((x & 0xF0F0F0F0F0F0F0F0) | (((x + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4))
+       != 0x3333333333333333)
+	return -1;
+
+    x -= 0x3030303030303030;
+    x = (x * 10 + (x >> 8)) & 0x00FF00FF00FF00FF;
+    x = (x * 100 + (x >> 16)) & 0x0000FFFF0000FFFF;
+    return (x * 10000 + (x >> 32)) & 0xFFFFFFFF;
+}
+#endif
+
+/*
+  txt (len chars) as an integer in base (2 to 36): an optional -, then
+  digits, with a $ (hexadecimal) or % (binary) prefix in any base, or
+  0x or 0b in base 10. Like the digits, a number too large wraps
+  around.
+*/
+bool parse_number(const char* txt, size_t len, unsigned base, i64* num)
+{
+    bool negative = len > 1 && *txt == '-';
+    if(negative) { txt++; len--; }
+
+    if(len > 1 && (*txt == '$' || *txt == '%'))
+    {
+	base = *txt == '$' ? 16 : 2;
+	txt++; len--;
+    }
+    else if(base == 10 && len > 2 && txt[0] == '0' && (txt[1] == 'x' || txt[1] == 'b'))
+    {
+	base = txt[1] == 'x' ? 16 : 2;
+	txt += 2; len -= 2;
+    }
+    if(len == 0) return false;
+
+    u64 n = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(base == 10)
+    {
+	for(; len >= 8 ; txt += 8, len -= 8)
+	{
+	    i64 d = eight_digits(txt);
+	    if(d < 0) return false;
+	    n = n * 100000000 + d;
+	}
+    }
+#endif
+    for(; len > 0 ; txt++, len--)
+    {
+	unsigned d = digit_value(*txt);
+	if(d >= base) return false;
+	n = n * base + d;
+    }
+
+    *num = negative ? -n : n;
+    return true;
+}
+
+// txt as a number of the interpreter of f, in f->radix, or as a double
+// in base 10 (see parse_float)
+bool parse_literal(forth_t* f, const char* txt, size_t len, u64* value)
+{
+    i64 num;
+    if(parse_number(txt, len, f->radix, &num))
+    {
+	*value = num;
+	return true;
+    }
+    return f->radix == 10 && parse_float(txt, len, value);
+}
+
+void doparse_number(forth_t* f)
+{
+    const char* txt = cast(const char*, pop(f));
+    push(f, 0);
+
+    push(f, parse_number(txt, strlen(txt), f->radix, cast(i64*, f->top_stack - 1)));
+}
+
+// some arithmetic stuff
+
+void add(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a + b;
+}
+
+void mult(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a * b;
+}
+
+void sub(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a - b;
+}
+
+void divmod(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    f->top_stack[-2] = a / b;
+    f->top_stack[-1] = a % b;
+}
+
+void eq(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a == b;
+}
+
+void lt(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a < b;
+}
+
+void gt(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a > b;
+}
+
+void leq(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a <= b;
+}
+
+void geq(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a >= b;
+}
+
+// logical stuff
+
+void donot(forth_t* f) { push(f, !pop(f)); }
+void doand(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a && b;
+}
+
+void door(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    i64 a = cast(i64, f->top_stack[-2]);
+    i64 b = cast(i64, f->top_stack[-1]);
+
+    pop(f);
+    f->top_stack[-1] = a || b;
+}
+
+// stack manipulation
+
+void drop(forth_t* f) { pop(f); }
+
+void swap(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64 a = pop(f);
+    u64 b = pop(f);
+    push(f, a);
+    push(f, b);
+}
+
+void dodup(forth_t* f)
+{
+    check(f->top_stack - f->stack >= 1);
+    u64 x = cast(u64, f->top_stack[-1]);
+
+    *f->top_stack = x;
+    ++f->top_stack;
+}
+
+void over(forth_t* f)
+{
+    check(f->top_stack - f->stack >= 2);
+    u64 x = cast(u64, f->top_stack[-2]);
+    push(f, x);
+}
+
+
+// IO stuff
+
+/*
+  Sources are read with read(2) on the descriptor of their FILE*, into
+  a buffer that the tokenizer scans directly, instead of going through
+  stdio (and its lock) for every char. Regular files are mmap'ed
+  instead, their buffer being the file itself: tokens are then slices
+  of the mapping, without any copy.
+*/
+#define SOURCE_BUFFER_SIZE 65536
+
+source_t* get_source(forth_t* f, FILE* file)
+{
+    for(source_t* src = f->sources ; src ; src = src->next)
+	if(src->file == file) return src;
+
+    source_t* src = malloc(sizeof(source_t));
+    src->file = file;
+    src->cap = 0; // allocated when first read
+    src->buf = NULL;
+    src->pos = src->len = 0;
+    src->eof = src->error = src->mapped = false;
+    src->tty = isatty(fileno(file));
+    src->forth = f;
+
+    struct stat st;
+    int fd = fileno(file);
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && offset >= 0)
+    {
+	char* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(p != MAP_FAILED)
+	{
+	    src->buf = p;
+	    src->pos = offset;
+	    src->len = src->cap = st.st_size;
+	    src->eof = src->mapped = true;
+	}
+    }
+
+    src->next = f->sources;
+    f->sources = src;
+    return src;
+}
+
+void free_source(forth_t* f, FILE* file)
+{
+    for(source_t** p = &f->sources ; *p ; p = &(*p)->next)
+    {
+	if((*p)->file != file) continue;
+
+	source_t* src = *p;
+	*p = src->next;
+	if(f->input == src) f->input = NULL;
+	if(src->mapped) munmap(src->buf, src->cap);
+	else free(src->buf);
+	free(src);
+	return;
+    }
+}
+
+void set_input(forth_t* f, FILE* file)
+{
+    f->input_stream = file;
+    f->input = get_source(f, file);
+}
+
+// read more data at the end of the buffer, first discarding what was
+// consumed before pos (so this moves the data left in the buffer);
+// returns false at the end of the file
+bool refill(source_t* src)
+{
+    if(src->eof) return false;
+
+    if(src->pos > 0)
+    {
+	memmove(src->buf, src->buf + src->pos, src->len - src->pos);
+	src->len -= src->pos;
+	src->pos = 0;
+    }
+    if(src->len == src->cap)
+    {
+	src->cap = src->cap ? 2 * src->cap : SOURCE_BUFFER_SIZE;
+	src->buf = realloc(src->buf, src->cap);
+    }
+
+    ssize_t n;
+    u64 start = now_ns();
+    int fd = fileno(src->file);
+    if(fd < 0) // e.g. from fmemopen
+    {
+	n = fread(src->buf + src->len, 1, src->cap - src->len, src->file);
+	if(n == 0 && ferror(src->file)) n = -1;
+    }
+    else
+    {
+	wait_input(src->forth, fd, false); // let the other coroutines run meanwhile
+	start = now_ns();
+	while((n = read(fd, src->buf + src->len, src->cap - src->len)) < 0)
+	{
+	    if(errno == EAGAIN) // e.g. a socket, waited for in io_wait
+	    {
+		count_io(src->forth, start);
+		wait_input(src->forth, fd, true);
+		start = now_ns();
+	    }
+	    else if(errno != EINTR) break;
+	}
+    }
+    count_io(src->forth, start);
+    stats_tick(src->forth);
+
+    if(n <= 0)
+    {
+	src->eof = true;
+	src->error = n < 0;
+	return false;
+    }
+    src->len += n;
+    return true;
+}
+
+// consume everything up to the next end of line
+void skip_line(source_t* src)
+{
+    while(true)
+    {
+	char* nl = memchr(src->buf + src->pos, '\n', src->len - src->pos);
+	if(nl)
+	{
+	    src->pos = nl - src->buf + 1;
+	    return;
+	}
+
+	src->pos = src->len;
+	if(!refill(src)) return;
+    }
+}
+
+bool is_delimiter(char c) { return isspace(cast(u8, c)) || c == '#'; }
+
+// skip whitespace and comments, then read a token; returns a pointer to
+// it in the buffer of src (valid until the next read from src) and its
+// length through len, or NULL at the end of the file
+const char* next_token(source_t* src, size_t* len)
+{
+    while(true)
+    {
+	if(src->pos == src->len && !refill(src)) return NULL;
+
+	char c = src->buf[src->pos];
+	if(c == '#') skip_line(src);
+	else if(isspace(cast(u8, c))) src->pos++;
+	else break;
+    }
+
+    size_t end = src->pos;
+    while(true)
+    {
+	while(end < src->len && !is_delimiter(src->buf[end])) end++;
+	if(end < src->len) break;
+
+	// the token may go on in the data that is not read yet
+	// (refill moves it to the start of the buffer, even at the end)
+	size_t n = end - src->pos;
+	bool more = refill(src);
+	end = src->pos + n;
+	if(!more) break;
+    }
+
+    const char* token = src->buf + src->pos;
+    *len = end - src->pos;
+    src->pos = end;
+
+    // consume the blank after the token (a comment is left to the next
+    // call, as skipping it may refill the buffer)
+    if(src->pos < src->len && src->buf[src->pos] != '#') src->pos++;
+    return token;
+}
+
+// read up to the next delim (which is consumed); same as next_token,
+// but NULL if the file ends first
+const char* next_until(source_t* src, char delim, size_t* len)
+{
+    size_t end = src->pos;
+    while(true)
+    {
+	char* p = memchr(src->buf + end, delim, src->len - end);
+	if(p)
+	{
+	    end = p - src->buf;
+	    break;
+	}
+
+	size_t n = src->len - src->pos;
+	if(!refill(src)) return NULL;
+	end = src->pos + n;
+    }
+
+    const char* s = src->buf + src->pos;
+    *len = end - src->pos;
+    src->pos = end + 1;
+    return s;
+}
+
+void input_failure(forth_t* f, source_t* src)
+{
+    print(f, "[failure in getchar]\n");
+    if(!src->error)
+	print(f, "[due to end of file]\n");
+    else
+	print(f, "[due to something else]\n");
+}
+
+void key(forth_t* f)
+{
+    source_t* src = f->input;
+    if(src->pos == src->len && !refill(src))
+    {
+	input_failure(f, src);
+	forth_error(f, NULL);
+    }
+
+    push(f, src->buf[src->pos++]);
+}
+
+// the C code uses next_token directly; this copies the token, as it
+// needs to be null terminated
+void word(forth_t* f)
+{
+    size_t len;
+    const char* token = next_token(f->input, &len);
+    if(!token)
+    {
+	input_failure(f, f->input);
+	forth_error(f, NULL);
+    }
+
+    if(len + 1 > f->word_cap)
+    {
+	while(len + 1 > f->word_cap) f->word_cap *= 2;
+	f->word_buf = realloc(f->word_buf, f->word_cap);
+    }
+    memcpy(f->word_buf, token, len);
+    f->word_buf[len] = '\0';
+    
+    push(f, cast(u64, f->word_buf));
+}
+
+// ( -- addr len ) the next token, in the buffer of the input (valid
+// until it is read again): no copy, unlike word
+void parse_name(forth_t* f)
+{
+    size_t len;
+    const char* token = next_token(f->input, &len);
+    if(!token)
+    {
+	input_failure(f, f->input);
+	forth_error(f, NULL);
+    }
+    push(f, cast(u64, token));
+    push(f, len);
+}
+
+/*
+  ( -- addr len ) the chars up to the next ", after s" and a blank.
+  When compiling, they are compiled with a litstring, which pushes
+  where they are in the thread; else they are copied to here, for good.
+*/
+void dostring(forth_t* f)
+{
+    size_t len;
+    const char* s = next_until(f->input, '"', &len);
+    if(!s)
+    {
+	input_failure(f, f->input);
+	forth_error(f, NULL);
+    }
+    size_t cells = (len + 7) / 8;
+    check(f->here + 8 * (cells + 2) <= f->words + f->word_size);
+
+    if(f->state == COMPILE_STATE)
+    {
+	*cast(u64**, f->here) = f->codewords[PRIM_LITSTRING];
+	*cast(u64*, f->here + 8) = len;
+	clear_cells(f, f->here, f->here + 16);
+	f->here += 16;
+    }
+    u8* p = f->here;
+    memcpy(p, s, len);
+    memset(p + len, 0, 8 * cells - len);
+    f->here += 8 * cells;
+    clear_cells(f, p, f->here);
+
+    if(f->state != COMPILE_STATE)
+    {
+	push(f, cast(u64, p));
+	push(f, len);
+    }
+}
+
+void emit(forth_t* f)
+{
+    check(f->top_stack - f->stack >= 1);
+    assert(f->top_stack[-1] < 256); // only ASCII
+    
+    put_output(f, cast(char, pop(f)));
+}
+
+void tell(forth_t* f)
+{
+    const char* s = cast(const char*, pop(f));
+    write_output(f, s, strlen(s));
+}
+
+// ( addr len -- ) write len bytes from addr
+void type(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64 len = pop(f);
+    write_output(f, cast(const void*, pop(f)), len);
+}
+
+void doflush(forth_t* f) { flush_output(f); }
+
+void dofind_word(forth_t* f)
+{
+    push(f, cast(u64, find_word(f, cast(const char*, pop(f)))));
+}
+
+// ( addr len -- word ) 0 if not found
+void find_name(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64 len = pop(f);
+    push(f, cast(u64, find_word_n(f, cast(const char*, pop(f)), len)));
+}
+
+void dostdin(forth_t* f) { push(f, cast(u64, stdin)); }
+
+void set_input_stream(forth_t* f) { set_input(f, cast(FILE*, pop(f))); }
+void get_input_stream(forth_t* f) { push(f, cast(u64, f->input_stream)); }
+
+void open_read_file(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    push(f, cast(u64, fopen(cast(const char*, pop(f)), "r")));
+}
+
+void close_file(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    FILE* file = cast(FILE*, pop(f));
+    free_source(f, file);
+    fclose(file);
+}
+
+u64* codeword(u8* word)
+{
+    u8* start = word;
+    
+    word += 9; // skip link ptr and flag byte
+    
+    while(*word) word++; // skip word name
+    word += 5; // null char, stack effect and kind
+    
+    // now align to 8bytes boundary
+    while((word - start) % 8 != 0) word++;
+    
+    return cast(u64*, word);
+}
+
+void docodeword(forth_t* f)
+{
+    push(f, cast(u64, codeword(cast(u8*, pop(f)))));
+}
+
+u8* wordname(u8* word) { return word + 9; }
+u8* wordtag(u8* word) { return word + 8; }
+u8 codeword_kind(u64* cw) { return cast(u8*, cw)[-1]; }
+
+/*
+  The stack effect of a word, in the 3 bytes before the kind of its
+  codeword: the cells it takes + 1 (0 if unknown), the cells it leaves
+  instead, and the most cells it has pushed above the ones it was given
+  at any point. Primitives have theirs from prim_effects, colon
+  definitions from analyze_word.
+*/
+u8* effect_bytes(u64* cw) { return cast(u8*, cw) - 4; }
+
+#define E(in, out) { (in) + 1, (out), (out) > (in) ? (out) - (in) : 0 }
+static const u8 prim_effects[PRIM_COUNT][3] = {
+    [PRIM_STACK_SIZE] = E(0, 1), [PRIM_DUP] = E(1, 2), [PRIM_OVER] = E(2, 3),
+    [PRIM_DROP] = E(1, 0), [PRIM_SWAP] = E(2, 2), [PRIM_NIP] = E(2, 1),
+    [PRIM_TWO_DUP] = E(2, 4),
+    [PRIM_ADD] = E(2, 1), [PRIM_MULT] = E(2, 1), [PRIM_SUB] = E(2, 1),
+    [PRIM_DIVMOD] = E(2, 2), [PRIM_EQ] = E(2, 1), [PRIM_LT] = E(2, 1),
+    [PRIM_GT] = E(2, 1), [PRIM_LEQ] = E(2, 1), [PRIM_GEQ] = E(2, 1),
+    [PRIM_NOT] = E(1, 1), [PRIM_AND] = E(2, 1), [PRIM_OR] = E(2, 1),
+    [PRIM_EXIT] = E(0, 0), [PRIM_IS_COMPILING] = E(0, 1), [PRIM_ERROR] = E(0, 0),
+    [PRIM_CODE_WORD] = E(1, 1),
+    [PRIM_KEY] = E(0, 1), [PRIM_EMIT] = E(1, 0), [PRIM_WORD] = E(0, 1),
+    [PRIM_TELL] = E(1, 0), [PRIM_TYPE] = E(2, 0), [PRIM_FLUSH] = E(0, 0),
+    [PRIM_PARSE_NUMBER] = E(1, 2), [PRIM_FIND_WORD] = E(1, 1),
+    [PRIM_PARSE_NAME] = E(0, 2), [PRIM_FIND_NAME] = E(2, 1),
+    [PRIM_COMMA] = E(1, 0), [PRIM_ALLOT] = E(1, 0), [PRIM_TICK] = E(0, 1),
+    [PRIM_HERE] = E(0, 1), [PRIM_LATEST] = E(0, 1), [PRIM_INLINE_LIMIT] = E(0, 1),
+    [PRIM_BASE] = E(0, 1),
+    [PRIM_FETCH] = E(1, 1), [PRIM_STORE] = E(2, 0), [PRIM_CFETCH] = E(1, 1),
+    [PRIM_CSTORE] = E(2, 0),
+    [PRIM_FADD] = E(2, 1), [PRIM_FSUB] = E(2, 1), [PRIM_FMULT] = E(2, 1),
+    [PRIM_FDIV] = E(2, 1), [PRIM_FSQRT] = E(1, 1), [PRIM_FEQ] = E(2, 1),
+    [PRIM_FLT] = E(2, 1), [PRIM_INT_TO_FLOAT] = E(1, 1), [PRIM_FLOAT_TO_INT] = E(1, 1),
+    [PRIM_VADD] = E(4, 0), [PRIM_VMULT] = E(4, 0), [PRIM_VSUM] = E(2, 1),
+    [PRIM_VDOT] = E(3, 1),
+    [PRIM_CMOVE] = E(3, 0), [PRIM_FILL] = E(3, 0), [PRIM_COMPARE] = E(4, 1),
+    [PRIM_SEARCH] = E(4, 3),
+    [PRIM_CONCAT] = E(5, 2), [PRIM_SLICE] = E(4, 2), [PRIM_HASH] = E(2, 1),
+    [PRIM_TO_NUMBER] = E(2, 2), [PRIM_NUMBER_TO_S] = E(2, 2),
+    [PRIM_ARENA_NEW] = E(1, 1), [PRIM_ARENA_ALLOC] = E(2, 1),
+    [PRIM_ARENA_MARK] = E(1, 1), [PRIM_ARENA_RELEASE] = E(2, 0),
+    [PRIM_ARENA_RESET] = E(1, 0), [PRIM_ARENA_FREE] = E(1, 0),
+    [PRIM_CHAN_SEND] = E(2, 0), [PRIM_CHAN_RECV] = E(1, 1),
+    [PRIM_CHAN_SEND_N] = E(3, 0), [PRIM_CHAN_RECV_N] = E(3, 0),
+    [PRIM_YIELD] = E(0, 0),
+    [PRIM_LIT] = E(0, 1), [PRIM_LITSTRING] = E(0, 2), [PRIM_LIT_ADD] = E(1, 1),
+    [PRIM_BRANCH] = E(0, 0), [PRIM_ZERO_BRANCH] = E(1, 0),
+    [PRIM_DUP_ZERO_BRANCH] = E(1, 1),
+    [PRIM_STDIN] = E(0, 1), [PRIM_PRINTSTACK] = E(0, 0), [PRIM_PRINTFLOAT] = E(1, 0),
+    [PRIM_PRINTSTATS] = E(0, 0), [PRIM_WRITE_STATS] = E(2, 0), [PRIM_STATS_EVERY] = E(3, 0),
+};
+#undef E
+
+// write the header of a new word at here (link, flags, name, stack
+// effect, kind and codeword) and make it the latest word; returns its
+// body
+u64* push_header(forth_t* f, const char* name, size_t len, u8 flags, prim_t* primitive)
+{
+    size_t namelen = len + 5; // include null char, stack effect and kind
+    // align to 8 bytes boundary, + 1 because flag already misaligns
+    if((namelen + 1) % 8 != 0) namelen += 8 - ((namelen + 1) % 8);
+
+    *cast(u8**, f->here) = f->latest; // next word
+    f->here[8] = flags;
+
+    memset(f->here + 9, 0, namelen);
+    memcpy(f->here + 9, name, len);
+    f->here[9 + namelen - 1] = prim_id(primitive);
+
+    u64* cw = cast(u64*, f->here + 9 + namelen);
+    *cw = cast(u64, primitive);
+    memcpy(effect_bytes(cw), prim_effects[prim_id(primitive)], 3);
+    if(prim_id(primitive) && !f->codewords[prim_id(primitive)])
+	f->codewords[prim_id(primitive)] = cw;
+
+    clear_cells(f, f->here, cast(u8*, cw + 1));
+    f->latest = f->here;
+    f->word_count++;
+    index_word(f, f->latest);
+    f->here = cast(u8*, cw + 1);
+    return cw + 1;
+}
+
+void semicolon(forth_t* f)
+{
+    assert(f->state == COMPILE_STATE); // must be in compile mode
+    f->state = NORMAL_STATE;
+
+    // put exit at the end to close the word
+    *cast(u64**, f->here) = f->codewords[PRIM_EXIT];
+    mark_cell(f, cast(u64*, f->here), false);
+    f->here += 8;
+
+    u64* cw = codeword(f->latest);
+    if(*cw == cast(u64, docol))
+    {
+	fuse_thread(f, cw + 1);
+	analyze_word(f, cw, thread_length(f, cw + 1, cast(u64*, f->here)));
+	jit_word(f, f->latest, f->here);
+    }
+}
+
+void here(forth_t* f) { push(f, cast(u64, &f->here)); }
+void latest(forth_t* f) { push(f, cast(u64, &f->latest)); }
+void inline_limit(forth_t* f) { push(f, cast(u64, &f->inline_limit)); }
+void dobase(forth_t* f) { push(f, cast(u64, &f->radix)); }
+
+void fetch(forth_t* f) { push(f, *cast(u64*, pop(f))); }
+void store(forth_t* f)
+{
+    u64 addr = pop(f);
+    u64 val = pop(f);
+    *cast(u64*, addr) = val;
+}
+
+void cfetch(forth_t* f) { push(f, *cast(u8*, pop(f))); }
+void cstore(forth_t* f)
+{
+    u64 addr = pop(f);
+    u64 val = pop(f);
+    *cast(u8*, addr) = val;
+}
+
+
+void colon(forth_t* f)
+{
+    // consume the next word
+    size_t len;
+    const char* name = next_token(f->input, &len);
+    if(!name)
+    {
+	input_failure(f, f->input);
+	forth_error(f, NULL);
+    }
+    
+    assert(f->state == NORMAL_STATE); // must be in normal mode
+    f->state = COMPILE_STATE;
+
+    push_header(f, name, len, 0, docol);
+}
+
+void comma(forth_t* f)
+{
+    u64 x = pop(f);
+    *cast(u64*, f->here) = x;
+    mark_cell(f, cast(u64*, f->here), cast(u8*, x) >= f->words && cast(u8*, x) < f->words + f->word_size);
+    f->here += 8; // because here is a u8*, not u64* !
+}
+
+// ( n -- ) reserve n bytes of the dictionary (give them back if < 0)
+void allot(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    i64 n = cast(i64, pop(f));
+    check(n >= -(f->here - f->words) && n <= cast(i64, f->word_size - (f->here - f->words)));
+    f->here += n;
+}
+
+void tick(forth_t* f)
+{
+    push(f, *f->next);
+    f->next += 1;
+}
+
+void printstack(forth_t* f)
+{
+    print(f, "stack: ");
+    u64* p = f->stack;
+    for(; p < f->top_stack - 1 ; p++)
+    {
+	print(f, "%" PRId64 " ", *p);
+    }
+    if(p < f->top_stack) print(f, "%" PRId64, *p);
+    print(f, "\n");
+}
+
+void printwords(forth_t* f)
+{
+    u8* latest = f->latest;
+    print(f, "words: ");
+    while(latest)
+    {
+	print(f, "%s", wordname(latest));
+	print(f, " ");
+
+	latest = *cast(u8**, latest);
+    }
+    print(f, "\n");
+}
+
+u8* push_primitive_word(forth_t* f, const char* name, u8 flags, prim_t* primitive)
+{
+    push_header(f, name, strlen(name), flags, primitive);
+    return f->latest;
+}
+
+u8* push_forth_word(forth_t* f, const char* name, u8 flags, u8** words)
+{
+    u64* body = push_header(f, name, strlen(name), flags, docol);
+
+    size_t n = 0;
+    for(; words[n] ; ++n)
+	body[n] = cast(u64, codeword(words[n])); // to link to codeword
+    body[n] = cast(u64, f->codewords[PRIM_EXIT]);
+
+    f->here = cast(u8*, body + n + 1);
+    clear_cells(f, cast(u8*, body), f->here);
+    return f->latest;
+}
+
+// same, but does not look for codewords; just put the content
+// straight in the body of the word; no need for exit though
+u8* push_forth_word_raw(forth_t* f, const char* name, u8 flags, u64* words)
+{
+    u64* body = push_header(f, name, strlen(name), flags, docol);
+
+    size_t n = 0;
+    for(; words[n] ; ++n)
+	body[n] = words[n];
+    body[n] = cast(u64, f->codewords[PRIM_EXIT]);
+
+    f->here = cast(u8*, body + n + 1);
+    clear_cells(f, cast(u8*, body), f->here);
+    return f->latest;
+}
+
+bool is_immediate_word(u8* word)
+{
+    return word[8] & IMMEDIATE_FLAG;
+}
+
+void immediate(forth_t* f)
+{
+    assert(f->latest);
+    *wordtag(f->latest) |= IMMEDIATE_FLAG;
+}
+
+// never copy the word being defined in threads, see inline_word
+void noinline(forth_t* f)
+{
+    assert(f->latest);
+    *wordtag(f->latest) |= NOINLINE_FLAG;
+}
+
+// keep the word being defined interpreted, see jit.c
+void nojit(forth_t* f)
+{
+    assert(f->latest);
+    *wordtag(f->latest) |= NOJIT_FLAG;
+}
+
+void dumpwords(forth_t* f)
+{
+    u8* latest = f->latest;
+    u64 exitcw = cast(u64, f->codewords[PRIM_EXIT]);
+
+    while(latest)
+    {
+	const char* name = cast(char*, wordname(latest));
+	u64* cw = codeword(latest);
+	bool native = codeword_kind(cw) == NATIVE_KIND;
+	
+	print(f, "found%s word %s at %p (cw at %p)\n", is_immediate_word(latest) ? " immediate" : "",
+	       name, latest, cw);
+	if((*cw == cast(u64, docol) && strcmp(name, "docol") != 0) || native)
+	{
+	    u8* e = effect_bytes(cw);
+	    print(f, "%s word", native ? "native" : "forth");
+	    if(e[0]) print(f, " ( %d -- %d, up to %d more )", e[0] - 1, e[1], e[2]);
+	    print(f, ", consisting of: \n");
+
+	    // now also print the content
+	    size_t n = 1;
+	    while(cw[n] != exitcw)
+	    {
+		print(f, "  %p\n", cast(u64*, cw[n]));
+		++n;
+	    }
+	}
+	else
+	    print(f, "primitive word\n");
+	
+	
+	print(f, "\n");
+	latest = *cast(u8**, latest);
+    }
+
+    print(f, "fused sites: %" PRIu64 "\n", f->fused);
+    print(f, "inlined calls: %" PRIu64 "\n", f->inlined);
+}
+
+#define PRIMITIVE_FN(id, name, flags, fn) fn,
+prim_t* const primitives[PRIM_COUNT] = { NULL, PRIMITIVES(PRIMITIVE_FN) };
+#undef PRIMITIVE_FN
+
+u8 prim_id(prim_t* primitive)
+{
+    for(u8 id = 1 ; id < PRIM_COUNT ; ++id)
+	if(primitives[id] == primitive) return id;
+    return PRIM_NONE;
+}
+
+/*
+  Reserve size bytes of address space between two guard pages, starting
+  at hint if possible. Nothing is committed until touched, so regions
+  can be made as large as needed, and running past one faults on its
+  guard page instead of requiring a check on every access.
+*/
+u8* new_region(size_t size, void* hint)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = (size + page - 1) / page * page;
+    if(hint) hint = cast(u8*, hint) - page;
+
+    u8* p = mmap(hint, len + 2 * page, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(p != MAP_FAILED);
+    mprotect(p, page, PROT_NONE);
+    mprotect(p + page + len, page, PROT_NONE);
+
+    return p + page;
+}
+
+void free_region(u8* region, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = (size + page - 1) / page * page;
+    munmap(region - page, len + 2 * page);
+}
+
+// the cell just below a stack is always mapped, so that the top of an
+// empty stack can be read (see the direct threaded run_word)
+u64* new_stack(size_t n) { return cast(u64*, new_region(8 * (n + 1), NULL)) + 1; }
+void free_stack(u64* stack, size_t n) { free_region(cast(u8*, stack - 1), 8 * (n + 1)); }
+
+// the number of operand cells following the instruction at ip in a
+// thread (a litstring has its length, then its chars)
+size_t operands(u64* ip)
+{
+    switch(codeword_kind(cast(u64*, *ip)))
+    {
+    case PRIM_LIT: case PRIM_LIT_ADD: case PRIM_TICK: case PRIM_TAIL_CALL:
+    case PRIM_BRANCH: case PRIM_ZERO_BRANCH: case PRIM_DUP_ZERO_BRANCH:
+	return 1;
+    case PRIM_LITSTRING:
+	return 1 + (ip[1] + 7) / 8;
+    default:
+	return 0;
+    }
+}
+
+bool is_branch(u64* cw)
+{
+    u8 kind = codeword_kind(cw);
+    return kind == PRIM_BRANCH || kind == PRIM_ZERO_BRANCH || kind == PRIM_DUP_ZERO_BRANCH;
+}
+
+// whether p is in the words of f, or of the forths it was forked from
+bool in_words(forth_t* f, u8* p)
+{
+    for(; f ; f = f->base)
+	if(p >= f->words && p < f->here) return true;
+    return false;
+}
+
+// whether p can be the codeword of a word of f
+bool is_codeword(forth_t* f, u64* p)
+{
+    return in_words(f, cast(u8*, p)) && cast(u64, p) % 8 == 0;
+}
+
+/*
+  The number of cells of the thread starting at body, up to its last
+  exit (the first one no branch jumps over), before end; 0 if it cannot
+  be compiled.
+*/
+size_t thread_length(forth_t* f, u64* body, u64* end)
+{
+    size_t n = end - body;
+    size_t reach = 0; // furthest branch target so far
+
+    for(size_t i = 0 ; i < n ; i += 1 + operands(body + i))
+    {
+	u64* cw = cast(u64*, body[i]);
+	if(!is_codeword(f, cw) || i + operands(body + i) >= n) return 0;
+
+	u8 kind = codeword_kind(cw);
+	if(kind == PRIM_RUN_WORD || cw == f->codewords[PRIM_DOCOL]) return 0;
+
+	if(is_branch(cw))
+	{
+	    i64 target = i + 2 + cast(i64, body[i + 1]);
+	    if(target < 0 || target > n) return 0;
+	    if(target > reach) reach = target;
+	}
+	if(kind == PRIM_EXIT && reach <= i) return i + 1;
+    }
+    return 0;
+}
+
+/*
+  Compute the stack effect of the colon definition of codeword cw, of n
+  cells (see thread_length), and store it in its header; returns
+  whether it could. Every path through the thread must have the same
+  depth at each instruction, and it may only call words with a known
+  effect, but for tail calls to itself (which go back to the start
+  with the depth of the start).
+*/
+bool analyze_word(forth_t* f, u64* cw, size_t n)
+{
+    if(n == 0) return false;
+
+    u64* body = cw + 1;
+    int* depth = malloc(n * sizeof(int)); // at each instruction, INT_MIN if not reached
+    size_t* todo = malloc(n * sizeof(size_t));
+    size_t ntodo = 0;
+    for(size_t i = 0 ; i < n ; ++i) depth[i] = INT_MIN;
+    int low = 0, high = 0, out = INT_MIN;
+    bool ok = true;
+
+#define REACH(target, d) do { size_t t_ = (target);			\
+	if(t_ >= n || (depth[t_] != INT_MIN && depth[t_] != (d))) ok = false; \
+	else if(depth[t_] == INT_MIN) { depth[t_] = (d); todo[ntodo++] = t_; } } while(0)
+
+    REACH(0, 0);
+    while(ok && ntodo > 0)
+    {
+	size_t i = todo[--ntodo];
+	int d = depth[i];
+	u64* p = cast(u64*, body[i]);
+	u8 kind = codeword_kind(p);
+	if(kind == PRIM_TAIL_CALL && cast(u64*, body[i + 1]) == cw)
+	{
+	    REACH(0, d);
+	    continue;
+	}
+
+	u8* e = effect_bytes(kind == PRIM_TAIL_CALL ? cast(u64*, body[i + 1]) : p);
+	if(e[0] == 0)
+	{
+	    ok = false;
+	    break;
+	}
+	int after = d - (e[0] - 1) + e[1];
+	if(d - (e[0] - 1) < low) low = d - (e[0] - 1);
+	if(d + e[2] > high) high = d + e[2];
+
+	if(kind == PRIM_EXIT || kind == PRIM_TAIL_CALL)
+	{
+	    if(out != INT_MIN && out != after) ok = false;
+	    out = after;
+	    continue;
+	}
+	if(is_branch(p)) REACH(i + 2 + cast(i64, body[i + 1]), after);
+	if(kind != PRIM_BRANCH) REACH(i + 1 + operands(body + i), after);
+    }
+#undef REACH
+
+    ok = ok && out != INT_MIN && -low < 255 && out - low < 256 && high < 256;
+    if(ok)
+    {
+	u8* e = effect_bytes(cw);
+	e[0] = 1 - low;
+	e[1] = out - low;
+	e[2] = high;
+    }
+    free(depth);
+    free(todo);
+    return ok;
+}
+
+/*
+  Peephole pass over a thread (from body up to here), run by semicolon:
+  - lit n +     -> lit+ n
+  - lit n -     -> lit+ -n
+  - dup 0branch -> dup0branch
+  - swap drop   -> nip
+  - over over   -> 2dup
+  - word exit   -> tailcall word, for a colon definition word (the last
+                   exit stays, to end the thread for its readers)
+  A sequence is left alone when a branch lands inside of it, and the
+  branch offsets are computed again for the compacted thread. Threads
+  that cannot be decoded (e.g. raw data compiled with ,) are left as is.
+*/
+void fuse_thread(forth_t* f, u64* body)
+{
+    enum { START = 0x1, TARGET = 0x2 };
+
+    size_t n = cast(u64*, f->here) - body;
+    u8* marks = calloc(n + 1, 1);
+    size_t* moved = malloc((n + 1) * sizeof(size_t)); // old index -> new index
+    size_t* branches = malloc(n * sizeof(size_t)); // new index of the branches
+    size_t nbranches = 0;
+    u64* out = malloc((n + 1) * sizeof(u64));
+    bool* pointers = calloc(n + 1, sizeof(bool)); // of out, see mark_cell
+    u64 fused = f->fused;
+
+    // decode the thread, and mark the branch targets
+    for(size_t i = 0 ; i < n ; i += 1 + operands(body + i))
+    {
+	u64* cw = cast(u64*, body[i]);
+	if(!is_codeword(f, cw) || i + operands(body + i) >= n) goto cleanup;
+
+	marks[i] |= START;
+	if(is_branch(cw))
+	{
+	    i64 target = i + 2 + cast(i64, body[i + 1]);
+	    if(target < 0 || target > n) goto cleanup;
+	    marks[target] |= TARGET;
+	}
+    }
+    marks[n] |= START;
+    for(size_t i = 0 ; i <= n ; ++i)
+	if((marks[i] & TARGET) && !(marks[i] & START)) goto cleanup;
+
+    size_t m = 0;
+    for(size_t i = 0 ; i < n ; )
+    {
+	u64* cw = cast(u64*, body[i]);
+	size_t len = 1 + operands(body + i);
+	u8 a = codeword_kind(cw);
+	// the following instruction, unless a branch lands on it
+	u8 b = i + len < n && !(marks[i + len] & TARGET) ?
+	    codeword_kind(cast(u64*, body[i + len])) : PRIM_NONE;
+
+	moved[i] = m;
+	if(a == PRIM_LIT && (b == PRIM_ADD || b == PRIM_SUB) && !is_pointer(f, body + i + 1))
+	{
+	    out[m++] = cast(u64, f->codewords[PRIM_LIT_ADD]);
+	    out[m++] = b == PRIM_ADD ? body[i + 1] : -body[i + 1];
+	    len = 3;
+	}
+	else if(a == PRIM_DUP && b == PRIM_ZERO_BRANCH)
+	{
+	    // store the old target for now, fixed below
+	    branches[nbranches++] = m;
+	    out[m++] = cast(u64, f->codewords[PRIM_DUP_ZERO_BRANCH]);
+	    out[m++] = i + 3 + cast(i64, body[i + 2]);
+	    len = 3;
+	}
+	else if(a == PRIM_SWAP && b == PRIM_DROP)
+	{
+	    out[m++] = cast(u64, f->codewords[PRIM_NIP]);
+	    len = 2;
+	}
+	else if(a == PRIM_OVER && b == PRIM_OVER)
+	{
+	    out[m++] = cast(u64, f->codewords[PRIM_TWO_DUP]);
+	    len = 2;
+	}
+	else if((a == PRIM_DOCOL || a == NATIVE_KIND) && cw != f->codewords[PRIM_DOCOL]
+		&& b == PRIM_EXIT)
+	{
+	    out[m++] = cast(u64, f->codewords[PRIM_TAIL_CALL]);
+	    pointers[m] = is_pointer(f, body + i);
+	    out[m++] = body[i];
+	    len = 2;
+	    if(i + 2 == n)
+	    {
+		pointers[m] = is_pointer(f, body + i + 1);
+		out[m++] = body[i + 1];
+	    }
+	}
+	else
+	{
+	    memcpy(out + m, body + i, len * sizeof(u64));
+	    for(size_t k = 0 ; k < len ; ++k) pointers[m + k] = is_pointer(f, body + i + k);
+	    if(is_branch(cw))
+	    {
+		branches[nbranches++] = m;
+		out[m + 1] = i + 2 + cast(i64, body[i + 1]);
+	    }
+	    m += len;
+	    i += len;
+	    continue;
+	}
+
+	f->fused++;
+	i += len;
+    }
+    moved[n] = m;
+
+    if(f->fused == fused) goto cleanup; // nothing fused
+
+    for(size_t k = 0 ; k < nbranches ; ++k)
+    {
+	size_t j = branches[k];
+	out[j + 1] = cast(i64, moved[out[j + 1]]) - cast(i64, j + 2);
+    }
+
+    memcpy(body, out, m * sizeof(u64));
+    for(size_t k = 0 ; k < n ; ++k) mark_cell(f, body + k, k < m && pointers[k]);
+    f->here = cast(u8*, body + m);
+
+cleanup:
+    free(pointers);
+    free(marks);
+    free(moved);
+    free(branches);
+    free(out);
+}
+
+/*
+  Copy the thread of word at here, instead of compiling a call to it,
+  when it is a colon definition of at most inline_limit cells (without
+  its last exit) and does not have the NOINLINE_FLAG. Its other exits
+  become branches to the end of the copy. Returns whether it was
+  inlined.
+*/
+bool inline_word(forth_t* f, u8* word)
+{
+    u64* cw = codeword(word);
+    u8 kind = codeword_kind(cw);
+    if(f->inline_limit == 0 || (*wordtag(word) & NOINLINE_FLAG)
+       || (kind != PRIM_DOCOL && kind != NATIVE_KIND) || cw == f->codewords[PRIM_DOCOL])
+	return false;
+    // a recursive call: the thread is not done yet
+    if(f->state == COMPILE_STATE && word == f->latest) return false;
+
+    // up to the here of the dictionary of word, past which are the left
+    // overs of fuse_thread
+    u64* body = cw + 1;
+    u64* end = body + f->inline_limit + 1;
+    for(forth_t* d = f ; d ; d = d->base)
+	if(cast(u8*, body) >= d->words && cast(u8*, body) < d->here && end > cast(u64*, d->here))
+	    end = cast(u64*, d->here);
+    size_t n = thread_length(f, body, end);
+    if(n == 0) return false;
+
+    size_t* moved = malloc((n + 1) * sizeof(size_t)); // old index -> new index
+    size_t m = 0;
+    for(size_t i = 0 ; i < n ; i += 1 + operands(body + i))
+    {
+	u64* cw = cast(u64*, body[i]);
+	moved[i] = m;
+	if(codeword_kind(cw) == PRIM_EXIT) m += i + 1 < n ? 2 : 0;
+	else if(codeword_kind(cw) == PRIM_TAIL_CALL) m += i + 3 < n ? 3 : 1;
+	else m += 1 + operands(body + i);
+    }
+    moved[n] = m;
+
+    // the bits of the cells copied go along, if they are ones of f
+    bool own = cast(u8*, body) >= f->words && cast(u8*, body) < f->here;
+    u64* out = cast(u64*, f->here);
+    clear_cells(f, cast(u8*, out), cast(u8*, out + m));
+    for(size_t i = 0 ; i < n ; i += 1 + operands(body + i))
+    {
+	u64* cw = cast(u64*, body[i]);
+	size_t j = moved[i];
+	if(codeword_kind(cw) == PRIM_EXIT)
+	{
+	    if(i + 1 == n) break;
+	    out[j] = cast(u64, f->codewords[PRIM_BRANCH]);
+	    out[j + 1] = cast(i64, m) - cast(i64, j + 2);
+	}
+	else if(codeword_kind(cw) == PRIM_TAIL_CALL)
+	{
+	    // a call, then the exit
+	    out[j] = body[i + 1];
+	    mark_cell(f, out + j, own && is_pointer(f, body + i + 1));
+	    if(i + 3 == n) continue;
+	    out[j + 1] = cast(u64, f->codewords[PRIM_BRANCH]);
+	    out[j + 2] = cast(i64, m) - cast(i64, j + 3);
+	}
+	else if(is_branch(cw))
+	{
+	    out[j] = body[i];
+	    mark_cell(f, out + j, own && is_pointer(f, body + i));
+	    out[j + 1] = cast(i64, moved[i + 2 + cast(i64, body[i + 1])]) - cast(i64, j + 2);
+	}
+	else
+	{
+	    size_t len = 1 + operands(body + i);
+	    memcpy(out + j, body + i, len * sizeof(u64));
+	    for(size_t k = 0 ; k < len ; ++k)
+		mark_cell(f, out + j + k, own && is_pointer(f, body + i + k));
+	}
+    }
+    free(moved);
+
+    f->here = cast(u8*, out + m);
+    f->inlined++;
+    return true;
+}
+
+// compile word at here, see inline_word; the operand of ' is always
+// the codeword itself
+void compile_word(forth_t* f, u8* word)
+{
+    bool operand = cast(u64**, f->here)[-1] == f->codewords[PRIM_TICK];
+    if(!operand && inline_word(f, word)) return;
+    *cast(u64**, f->here) = codeword(word);
+    mark_cell(f, cast(u64*, f->here), false);
+    f->here += 8;
+}
+
+// a forth without any word; its words array is mapped at hint if possible
+forth_t* empty_forth(const forth_sizes_t* sizes, void* hint)
+{
+    forth_t* f = calloc(1, sizeof(forth_t));
+    f->word_size = sizes->word_size;
+    f->stack_size = sizes->stack_size;
+    f->rstack_size = sizes->rstack_size;
+
+    f->words = new_region(f->word_size, hint);
+    f->pointers = cast(u64*, new_region(pointers_size(f), NULL));
+    f->stack = new_stack(f->stack_size);
+    f->rstack = new_stack(f->rstack_size);
+
+
+    f->here = f->words;
+    f->latest = NULL;
+
+    f->index_size = 256;
+    f->index_count = 0;
+    f->index = calloc(f->index_size, sizeof(u8*));
+
+    f->top_stack = f->stack;
+    f->top_rstack = f->rstack;
+
+    // by default, read from stdin and write to stdout
+    f->sources = NULL;
+    set_input(f, stdin);
+    set_output(f, stdout, default_output_size, false);
+    f->word_cap = 64;
+    f->word_buf = malloc(f->word_cap);
+    f->state = NORMAL_STATE;
+    f->inline_limit = 8;
+    f->radix = 10;
+    prof_init(f);
+    stats_init(f);
+
+    return f;
+}
+
+forth_t* new_forth_sized(const forth_sizes_t* sizes)
+{
+    forth_t* f = empty_forth(sizes, NULL);
+
+#define PUSH_PRIMITIVE(id, name, flags, fn) push_primitive_word(f, name, flags, fn);
+    PRIMITIVES(PUSH_PRIMITIVE)
+#undef PUSH_PRIMITIVE
+    
+    return f;
+}
+
+forth_t* new_forth() { return new_forth_sized(&default_sizes); }
+
+void relocate_words(forth_t* f, u8* start, u8* end, u8* old, size_t size);
+
+// a new forth with a copy of the dictionary of base (but not its
+// stacks nor its sources), e.g. to get a fresh instance from a forth
+// that interpreted startup.f; NULL if base is a fork, whose words
+// link to the ones of its base
+forth_t* clone_forth(forth_t* base)
+{
+    if(base->base) return NULL;
+    forth_sizes_t sizes = { base->word_size, base->stack_size, base->rstack_size };
+    forth_t* f = empty_forth(&sizes, NULL);
+    
+    size_t used = base->here - base->words;
+    memcpy(f->words, base->words, used);
+    f->here = f->words + used;
+    f->latest = base->latest ? f->words + (base->latest - base->words) : NULL;
+    f->word_count = base->word_count;
+    f->fused = base->fused;
+    f->radix = base->radix;
+    f->inline_limit = base->inline_limit;
+    memcpy(f->pointers, base->pointers, (used / 8 + 63) / 64 * 8);
+    relocate_words(f, f->words, f->here, base->words, used);
+
+    for(size_t id = 0 ; id < PRIM_COUNT ; ++id)
+	if(base->codewords[id])
+	    f->codewords[id] = cast(u64*, f->words + (cast(u8*, base->codewords[id]) - base->words));
+
+    free(f->index);
+    f->index_size = base->index_size;
+    f->index_count = base->index_count;
+    f->index = calloc(f->index_size, sizeof(u8*));
+    for(size_t i = 0 ; i < f->index_size ; ++i)
+	if(base->index[i]) f->index[i] = f->words + (base->index[i] - base->words);
+
+    inherit_output(f, base);
+    f->cache_dir = base->cache_dir;
+    f->epoll = base->epoll;
+    jit_words(f); // the native code of base calls its own words
+    return f;
+}
+
+/*
+  A new forth sharing the words of base, without copying them: lookups
+  that fail in its own index go on in the one of base, and its latest
+  word starts as the one of base. base is frozen first: its words are
+  made read-only (so they can be shared by forths running on other
+  threads) and it must not define words anymore. It must also outlive
+  the forks.
+*/
+forth_t* fork_forth(forth_t* base)
+{
+    if(!base->frozen)
+    {
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t used = (base->here - base->words + page - 1) / page * page;
+	mprotect(base->words, used, PROT_READ);
+	base->frozen = true;
+    }
+    return share_forth(base);
+}
+
+// fork_forth, without freezing base (see task.c)
+forth_t* share_forth(forth_t* base)
+{
+    forth_sizes_t sizes = { base->word_size, base->stack_size, base->rstack_size };
+    forth_t* f = empty_forth(&sizes, NULL);
+    f->base = base;
+    f->latest = base->latest;
+    f->word_count = base->word_count;
+    memcpy(f->codewords, base->codewords, sizeof(f->codewords));
+    inherit_output(f, base);
+    f->workers = base->workers;
+    f->epoll = base->epoll;
+    return f;
+}
+
+void free_forth(forth_t* f)
+{
+    free_pool(f); // its workers share the words of f
+    free_coros(f);
+    free_io(f);
+    free_region(f->words, f->word_size);
+    free_region(cast(u8*, f->pointers), pointers_size(f));
+    free(f->index);
+    while(f->sources) free_source(f, f->sources->file);
+    free(f->word_buf);
+    free_jit(f);
+    prof_free(f);
+    stats_free(f);
+    free_output(f);
+    free_arenas(f);
+    free_stack(f->stack, f->stack_size);
+    free_stack(f->rstack, f->rstack_size);
+    free(f);
+}
+
+// FNV-1a
+u64 hash_name(const char* name, size_t len)
+{
+    u64 h = 0xcbf29ce484222325;
+    for(size_t i = 0 ; i < len ; ++i)
+    {
+	h ^= cast(u8, name[i]);
+	h *= 0x100000001b3;
+    }
+    return h;
+}
+
+bool has_name(u8* word, const char* name, size_t len)
+{
+    const char* wname = cast(const char*, wordname(word));
+    return memcmp(wname, name, len) == 0 && wname[len] == '\0';
+}
+
+// put word in the index, shadowing any older word with the same name
+void index_insert(u8** index, size_t size, u8* word)
+{
+    const char* name = cast(const char*, wordname(word));
+    size_t len = strlen(name);
+    size_t mask = size - 1;
+    size_t i = hash_name(name, len) & mask;
+
+    while(index[i] && !has_name(index[i], name, len))
+	i = (i + 1) & mask;
+    index[i] = word;
+}
+
+void index_word(forth_t* f, u8* word)
+{
+    // keep the load factor below 1/2 so that probe chains stay short
+    if(2 * (f->index_count + 1) > f->index_size)
+    {
+	size_t size = 2 * f->index_size;
+	u8** index = calloc(size, sizeof(u8*));
+	for(size_t i = 0 ; i < f->index_size ; ++i)
+	    if(f->index[i]) index_insert(index, size, f->index[i]);
+
+	free(f->index);
+	f->index = index;
+	f->index_size = size;
+    }
+
+    // only count new names, redefinitions reuse their slot
+    const char* name = cast(const char*, wordname(word));
+    if(!index_lookup(f->index, f->index_size, name, strlen(name))) f->index_count++;
+    index_insert(f->index, f->index_size, word);
+}
+
+u8* index_lookup(u8** index, size_t size, const char* name, size_t len)
+{
+    size_t mask = size - 1;
+    size_t i = hash_name(name, len) & mask;
+
+    while(index[i])
+    {
+	if(has_name(index[i], name, len))
+	    return index[i];
+
+	i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+u8* find_word_n(forth_t* f, const char* name, size_t len)
+{
+    for(; f ; f = f->base)
+    {
+	u8* word = index_lookup(f->index, f->index_size, name, len);
+	if(word) return word;
+    }
+    return NULL;
+}
+
+u8* find_word(forth_t* f, const char* name) { return find_word_n(f, name, strlen(name)); }
+
+/*
+  Images: a dump of the words array, from which a forth starts without
+  defining its primitives or interpreting anything. The file holds an
+  image_header, the hash index (as word offsets + 1, 0 for empty slots),
+  the bits of the cells that hold pointers (see write_pointers) and, at
+  offset data (in pages), the words themselves; they are
+  mmap'ed back at the address they were saved from when possible, and
+  relocated otherwise. The codewords of primitives are saved as their
+  kind byte only, and set again when loading.
+*/
+#define IMAGE_MAGIC "FORTHIMG"
+#define IMAGE_VERSION 3
+
+typedef struct
+{
+    char magic[8];
+    u64 version;
+    u64 nprimitives; // PRIM_COUNT of the saving forth
+    u64 base; // address of the words array when saved
+    u64 here; // offsets in the words array
+    u64 latest; // + 1, 0 if no word
+    u64 word_size;
+    u64 index_size;
+    u64 index_count;
+    u64 data; // file offset of the words
+    u64 fused;
+} image_header_t;
+
+// the word defined right after word, or NULL if it is the latest one
+u8* word_after(forth_t* f, u8* word)
+{
+    u8* after = NULL;
+    for(u8* w = f->latest ; w && w != word ; w = *cast(u8**, w)) after = w;
+    return after;
+}
+
+/*
+  Move every pointer to the words array stored in the words between
+  start and end from the array at old to the one of f, which holds a
+  copy of it: the cells that mark_cell says hold pointers (anywhere in
+  the array), then the links and, in the threads, the codewords and
+  the operands of ' and tailcall that are not such cells. The old array
+  may not be mapped anymore: kinds are always read from f.
+*/
+void relocate_words(forth_t* f, u8* start, u8* end, u8* old, size_t size)
+{
+    i64 delta = f->words - old;
+    if(delta == 0) return;
+
+    for(u64* p = cast(u64*, start) ; p < cast(u64*, end) ; ++p)
+	if(is_pointer(f, p) && cast(u8*, *p) >= old && cast(u8*, *p) < old + f->word_size)
+	    *p += delta;
+
+#define MOVED(x) (cast(u8*, x) >= old && cast(u8*, x) < old + size ? (x) + delta : (x))
+#define RELOCATE(cell) do { if(!is_pointer(f, cell)) *(cell) = MOVED(*(cell)); } while(0)
+
+    // the links are relocated while walking them, hence latest first
+    u8* after = NULL;
+    for(u8* w = f->latest ; w && w >= start ; after = w, w = *cast(u8**, w))
+    {
+	if(w >= end) continue;
+	RELOCATE(cast(u64*, w));
+
+	u64* cw = codeword(w);
+	if(codeword_kind(cw) != PRIM_DOCOL && codeword_kind(cw) != NATIVE_KIND) continue;
+
+	// the thread goes up to the next word in memory, or to raw data
+	u64* stop = cast(u64*, after && after < end ? after : end);
+	for(u64* p = cw + 1 ; p < stop ; )
+	{
+	    if(!is_codeword(f, cast(u64*, is_pointer(f, p) ? *p : MOVED(*p)))) break;
+	    RELOCATE(p);
+	    size_t n = operands(p);
+	    u8 kind = codeword_kind(cast(u64*, *p));
+	    if((kind == PRIM_TICK || kind == PRIM_TAIL_CALL) && p + 1 < stop)
+		RELOCATE(p + 1);
+	    p += 1 + n;
+	}
+    }
+#undef RELOCATE
+#undef MOVED
+}
+
+/*
+  The bits of mark_cell of the cells from start to end, packed from the
+  one of start, to file or back from it (for images and segments, see
+  cache.c)
+*/
+bool write_pointers(forth_t* f, FILE* file, u8* start, u8* end)
+{
+    for(u64* p = cast(u64*, start) ; p < cast(u64*, end) ; p += 64)
+    {
+	u64 bits = 0;
+	for(size_t k = 0 ; k < 64 && p + k < cast(u64*, end) ; ++k)
+	    bits |= cast(u64, is_pointer(f, p + k)) << k;
+	if(fwrite(&bits, sizeof(bits), 1, file) != 1) return false;
+    }
+    return true;
+}
+
+bool read_pointers(forth_t* f, FILE* file, u8* start, u8* end)
+{
+    for(u64* p = cast(u64*, start) ; p < cast(u64*, end) ; p += 64)
+    {
+	u64 bits;
+	if(fread(&bits, sizeof(bits), 1, file) != 1) return false;
+	for(size_t k = 0 ; k < 64 && p + k < cast(u64*, end) ; ++k)
+	    mark_cell(f, p + k, (bits >> k) & 1);
+    }
+    return true;
+}
+
+// set the codewords of primitives again from their kinds
+void link_primitives(forth_t* f)
+{
+    for(u8* w = f->latest ; w ; w = *cast(u8**, w))
+    {
+	u64* cw = codeword(w);
+	u8 kind = codeword_kind(cw);
+	*cw = cast(u64, primitives[kind]);
+	f->codewords[kind] = cw;
+    }
+}
+
+bool save_image(forth_t* f, const char* path)
+{
+    if(f->base)
+    {
+	print(f, "[cannot save the image of a fork]\n");
+	return false;
+    }
+
+    for(u8* w = f->latest ; w ; w = *cast(u8**, w))
+    {
+	if(codeword_kind(codeword(w)) == PRIM_NONE)
+	{
+	    print(f, "[cannot save %s: unknown primitive]\n", wordname(w));
+	    return false;
+	}
+    }
+
+    FILE* file = fopen(path, "w");
+    if(!file) return false;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t cells = (f->here - f->words) / 8;
+    size_t data = sizeof(image_header_t) + f->index_size * sizeof(u64) + (cells + 63) / 64 * 8;
+    data = (data + page - 1) / page * page;
+
+    image_header_t header = {
+	.magic = IMAGE_MAGIC,
+	.version = IMAGE_VERSION,
+	.nprimitives = PRIM_COUNT,
+	.base = cast(u64, f->words),
+	.here = f->here - f->words,
+	.latest = f->latest ? f->latest - f->words + 1 : 0,
+	.word_size = f->word_size,
+	.index_size = f->index_size,
+	.index_count = f->index_count,
+	.data = data,
+	.fused = f->fused,
+    };
+    fwrite(&header, sizeof(header), 1, file);
+
+    for(size_t i = 0 ; i < f->index_size ; ++i)
+    {
+	u64 offset = f->index[i] ? f->index[i] - f->words + 1 : 0;
+	fwrite(&offset, sizeof(offset), 1, file);
+    }
+    write_pointers(f, file, f->words, f->here);
+
+    fseek(file, data, SEEK_SET);
+    fwrite(f->words, 1, f->here - f->words, file);
+
+    // native code is not saved, these are compiled again when loading
+    for(u8* w = f->latest ; w ; w = *cast(u8**, w))
+    {
+	u8* kind = cast(u8*, codeword(w)) - 1;
+	if(*kind != NATIVE_KIND) continue;
+	fseek(file, data + (kind - f->words), SEEK_SET);
+	fputc(PRIM_DOCOL, file);
+    }
+    return fclose(file) == 0;
+}
+
+forth_t* load_image(const char* path, const forth_sizes_t* sizes)
+{
+    FILE* file = fopen(path, "r");
+    if(!file) return NULL;
+
+    image_header_t header;
+    if(fread(&header, sizeof(header), 1, file) != 1
+       || memcmp(header.magic, IMAGE_MAGIC, 8) != 0
+       || header.version != IMAGE_VERSION
+       || header.nprimitives != PRIM_COUNT)
+    {
+	fclose(file);
+	return NULL;
+    }
+
+    forth_sizes_t image_sizes = *sizes;
+    if(image_sizes.word_size < header.here) image_sizes.word_size = header.word_size;
+
+    forth_t* f = empty_forth(&image_sizes, cast(void*, header.base));
+    if(header.here > 0)
+    {
+	void* p = mmap(f->words, header.here, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_FIXED, fileno(file), header.data);
+	if(p == MAP_FAILED)
+	{
+	    free_forth(f);
+	    fclose(file);
+	    return NULL;
+	}
+    }
+    f->here = f->words + header.here;
+    f->latest = header.latest ? f->words + header.latest - 1 : NULL;
+    f->fused = header.fused;
+
+    fseek(file, sizeof(header) + header.index_size * sizeof(u64), SEEK_SET);
+    if(!read_pointers(f, file, f->words, f->here))
+    {
+	free_forth(f);
+	fclose(file);
+	return NULL;
+    }
+    fseek(file, sizeof(header), SEEK_SET);
+    relocate_words(f, f->words, f->here, cast(u8*, header.base), header.here);
+    for(u8* w = f->latest ; w ; w = *cast(u8**, w)) f->word_count++;
+    link_primitives(f);
+    jit_words(f);
+
+    free(f->index);
+    f->index_size = header.index_size;
+    f->index_count = header.index_count;
+    f->index = calloc(f->index_size, sizeof(u8*));
+    for(size_t i = 0 ; i < f->index_size ; ++i)
+    {
+	u64 offset;
+	if(fread(&offset, sizeof(offset), 1, file) != 1) break;
+	if(offset) f->index[i] = f->words + offset - 1;
+    }
+
+    fclose(file);
+    return f;
+}
+
+void dosave_image(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    if(!save_image(f, cast(const char*, pop(f))))
+	print(f, "[failed to save image]\n");
+}
+
+/*
+  Stop running f: resume the innermost run_file, or exit the program
+  when there is none. message, if any, is printed first.
+*/
+void forth_error(forth_t* f, const char* message)
+{
+    if(message) print(f, "%s\n", message);
+    flush_output(f);
+    if(f->on_error) longjmp(*f->on_error, 1);
+    exit(EXIT_FAILURE);
+}
+
+// the colon definition of codeword cw was entered without the cells
+// it takes, or the room for the ones it pushes (see analyze_word)
+void stack_error(forth_t* f, u64* cw)
+{
+    const char* name = "?";
+    for(u8* w = f->latest ; w ; w = *cast(u8**, w))
+	if(codeword(w) == cw) name = cast(const char*, wordname(w));
+    print(f, "[stack %s in %s]\n", stack_size(f) + 1 < effect_bytes(cw)[0] ? "underflow" : "overflow", name);
+    flush_output(f);
+    count_call(f, cw); // it was not, as it was not entered
+    print_trace(f);
+    forth_error(f, NULL);
+}
+
+void unknown_word(forth_t* f, const char* name, size_t len)
+{
+    print(f, "failed to find %.*s\n", cast(int, len), name);
+    forth_error(f, NULL);
+}
+
+/*
+  The word named txt (len chars), or NULL if it is a number (its value
+  in *value); an error if neither. Only tokens that start like one (a
+  digit, . or a prefix, after an optional -) are parsed before being
+  looked up: in bases above 10, the others are parsed if there is no
+  such word, as letters are digits too.
+*/
+static u8* find_token(forth_t* f, const char* txt, size_t len, u64* value)
+{
+    char c = len > 1 && txt[0] == '-' ? txt[1] : txt[0];
+    bool numeric = isdigit(cast(u8, c)) || c == '.' || c == '$' || c == '%';
+    if(numeric && parse_literal(f, txt, len, value)) return NULL;
+
+    u8* word = find_word_n(f, txt, len);
+    if(word) return word;
+    if(!numeric && f->radix > 10 && parse_literal(f, txt, len, value)) return NULL;
+    unknown_word(f, txt, len);
+    return NULL;
+}
+
+void repl(forth_t* f)
+{
+    u8* lit = find_word(f, "lit"); assert(lit);
+    
+    while(true)
+    {
+	// show what was printed before waiting for the user
+	if(f->input->tty && f->input->pos == f->input->len) flush_output(f);
+
+	size_t len;
+	const char* wordstring = next_token(f->input, &len);
+	if(!wordstring)
+	{
+	    if(f->input->error) input_failure(f, f->input);
+	    return;
+	}
+	
+	u64 value;
+	u8* next = find_token(f, wordstring, len, &value);
+	if(f->state == NORMAL_STATE)
+	{
+	    if(!next) push(f, value);
+	    if(!next || (!is_immediate_word(next) && codeword(next) != f->codewords[PRIM_COLON]))
+		f->effects++;
+	    if(next) run_word(f, next);
+	}
+	else if(f->state == COMPILE_STATE)
+	{
+	    if(!next)
+	    {
+		// put LIT, then the number
+		*cast(u64**, f->here) = codeword(lit);
+		*cast(u64*, f->here + 8) = value;
+		clear_cells(f, f->here, f->here + 16);
+		f->here += 16;
+	    }
+	    else if(is_immediate_word(next)) run_word(f, next);
+	    else compile_word(f, next);
+	}
+	else assert(false); // should not happen
+    }
+}
+
+/*
+  Interpret file until its end, then read from the previous input of f
+  again. An error (see forth_error) stops the file, and leaves f ready
+  for another one: empty stacks and normal state. Returns 0, or 1 if
+  the file was stopped by an error.
+*/
+int run_file(forth_t* f, FILE* file)
+{
+    jmp_buf env;
+    jmp_buf* outer = f->on_error;
+    FILE* previous = f->input_stream;
+    volatile int status = 0;
+
+    set_input(f, file);
+    f->on_error = &env;
+    if(setjmp(env) == 0)
+    {
+	repl(f);
+	if(f->state == COMPILE_STATE)
+	    forth_error(f, "[end of file in a definition]");
+    }
+    else
+    {
+	status = 1;
+	f->top_stack = f->stack;
+	f->top_rstack = f->rstack;
+	f->state = NORMAL_STATE;
+    }
+    f->on_error = outer;
+
+    free_source(f, file);
+    if(previous != file) set_input(f, previous);
+    return status;
+}
+
+// colon definitions (native ones included) count their own calls
+void run_word(forth_t* f, u8* word)
+{
+    u64* cw = codeword(word);
+    u8 kind = codeword_kind(cw);
+    if(kind != PRIM_DOCOL && kind != NATIVE_KIND) count_call(f, cw);
+    stats_tick(f);
+    run_codeword(f, cw);
+}
+
+#ifndef DIRECT_THREADED
+
+void run_codeword(forth_t* f, u64* cw)
+{
+    running_forth = f;
+    f->current = cw;
+    f->next = NULL;
+
+    void (*p)(forth_t*) = NULL;
+    while(true)
+    {
+	p = *cast(void (**)(forth_t*), f->current);
+	PROF_DISPATCH(f, f->current);
+#ifndef FORTH_PROFILE
+	f->stats.dispatches++; // else by prof_dispatch
+#endif
+	p(f);
+	if(f->stats.due) stats_tick(f);
+
+	if(!f->next) break;
+	
+	f->current = *cast(u64**, f->next);
+	f->next += 1;
+    }
+}
+
+#else
+
+/*
+  Same interpreter, using GCC's labels as values: the kind byte of each
+  codeword selects the code to jump to, and NEXT, the stacks pointers
+  and the hot primitives live in this function. Primitives without a
+  label are called like above, after syncing the state in f.
+
+  The top of the stack is cached in tos, sp pointing to the cell where
+  it belongs: an empty stack has its (garbage) top in the cell below
+  f->stack. With SWITCH_DISPATCH, every instruction goes back to a
+  single switch on the kind instead, as in a switch-threaded
+  interpreter, to compare the two.
+*/
+void run_codeword(forth_t* f, u64* cw)
+{
+#define HOT_OPS(X)							\
+    X(DOCOL, docol) X(EXIT, exit) X(LIT, lit) X(BRANCH, branch)		\
+    X(ZERO_BRANCH, zero_branch) X(LIT_ADD, lit_add)			\
+    X(DUP_ZERO_BRANCH, dup_zero_branch) X(NIP, nip) X(TWO_DUP, two_dup) \
+    X(DUP, dup) X(OVER, over) X(DROP, drop) X(SWAP, swap)		\
+    X(ADD, add) X(MULT, mult) X(SUB, sub) X(EQ, eq) X(LT, lt) X(GT, gt)	\
+    X(LEQ, leq) X(GEQ, geq) X(NOT, not) X(AND, and) X(OR, or)		\
+    X(FETCH, fetch) X(STORE, store) X(CFETCH, cfetch) X(CSTORE, cstore) \
+    X(TAIL_CALL, tail_call)
+
+#ifndef SWITCH_DISPATCH
+    // indexed by kind, which may also be NATIVE_KIND
+#define OP_LABEL(id, name) [PRIM_##id] = &&op_##name,
+    static void* const ops[256] = {
+	[0 ... 255] = &&op_call,
+	HOT_OPS(OP_LABEL)
+    };
+#undef OP_LABEL
+#endif
+
+    u64* const stack = f->stack;
+    u64* const rstack = f->rstack;
+    const size_t stack_max = f->stack_size;
+    u64* current = cw;
+    u64* next = NULL;
+    u64* sp = f->top_stack - 1;
+    u64 tos = *sp;
+    u64* rp = f->top_rstack;
+    u64* sp_peak = sp;
+    u64* rp_peak = rp;
+    (void)stack_max; // only used by check
+    running_forth = f;
+
+#define DEPTH (sp + 1 - stack)
+#ifdef SWITCH_DISPATCH
+#define DISPATCH goto dispatch
+#else
+#define DISPATCH goto *ops[codeword_kind(current)]
+#endif
+#if defined(COUNT_DISPATCHES) && !defined(FORTH_PROFILE)
+#define COUNT_DISPATCH() (f->stats.dispatches++)
+#else
+#define COUNT_DISPATCH() ((void)0) // else by prof_dispatch, if at all
+#endif
+#define NEXT do { current = *cast(u64**, next); next++;		\
+	PROF_DISPATCH(f, current); COUNT_DISPATCH(); DISPATCH; } while(0)
+#define BINARY(op) do { check(DEPTH >= 2);				\
+	tos = cast(i64, sp[-1]) op cast(i64, tos); sp--; NEXT; } while(0)
+    // after a push: the peaks are kept as the highest sp and rp, which
+    // are only turned into depths (see SYNC_PEAKS) when f is synced
+#define PEAK do { if(sp > sp_peak) sp_peak = sp; } while(0)
+#define SYNC_PEAKS do {							\
+	if(cast(u64, sp_peak + 1 - stack) > f->stats.stack_peak)	\
+	    f->stats.stack_peak = sp_peak + 1 - stack;			\
+	if(cast(u64, rp_peak - rstack) > f->stats.rstack_peak)		\
+	    f->stats.rstack_peak = rp_peak - rstack;			\
+    } while(0)
+    // NEXT, at calls and branches: the loops go through one of them
+#define NEXT_POLL do { if(f->stats.due) goto tick; NEXT; } while(0)
+
+    // there is no thread to continue from if word is a primitive
+    PROF_DISPATCH(f, current);
+    COUNT_DISPATCH();
+    if(codeword_kind(current) == PRIM_DOCOL) goto op_docol;
+    goto op_call;
+
+#ifdef SWITCH_DISPATCH
+    // one indirect jump shared by every instruction, instead of one each
+dispatch:
+    switch(codeword_kind(current))
+    {
+#define OP_CASE(id, name) case PRIM_##id: goto op_##name;
+	HOT_OPS(OP_CASE)
+#undef OP_CASE
+    default: goto op_call;
+    }
+#endif
+
+op_call:
+    *sp = tos;
+    SYNC_PEAKS;
+    f->current = current; f->next = next;
+    f->top_stack = sp + 1; f->top_rstack = rp;
+    (*cast(prim_t**, current))(f);
+    next = f->next;
+    sp = f->top_stack - 1; tos = *sp;
+    rp = f->top_rstack;
+    if(!next) goto done;
+    NEXT;
+
+op_docol:
+    PROF_ENTER(f, current);
+    check(rp - rstack < f->rstack_size);
+    if(bad_entry(f, current, DEPTH))
+    {
+	*sp = tos;
+	f->top_stack = sp + 1; f->top_rstack = rp;
+	stack_error(f, current);
+    }
+    *rp++ = cast(u64, next);
+    if(rp > rp_peak) rp_peak = rp;
+    next = current + 1;
+    count_call(f, current);
+    NEXT_POLL;
+
+    // once the timer is due: f is synced around stats_tick as for a
+    // primitive, so that no register has to be kept across the call
+tick:
+    *sp = tos;
+    SYNC_PEAKS;
+    f->current = current; f->next = next;
+    f->top_stack = sp + 1; f->top_rstack = rp;
+    stats_tick(f);
+    next = f->next;
+    sp = f->top_stack - 1; tos = *sp;
+    rp = f->top_rstack;
+    NEXT;
+
+op_exit:
+    PROF_EXIT(f);
+    check(rp > rstack);
+    next = cast(u64*, *--rp);
+    if(!next) goto done;
+    NEXT;
+
+op_tail_call:
+    PROF_EXIT(f);
+    check(rp > rstack);
+    current = cast(u64*, *next);
+    next = cast(u64*, *--rp);
+    PROF_DISPATCH(f, current);
+    COUNT_DISPATCH();
+    DISPATCH;
+
+op_lit:
+    check(DEPTH < stack_max);
+    *sp++ = tos;
+    tos = *next++;
+    PEAK;
+    NEXT;
+
+op_branch:
+    next += cast(i64, *next) + 1;
+    NEXT_POLL;
+
+op_zero_branch:
+    check(DEPTH >= 1);
+    {
+	u64 flag = tos;
+	tos = *--sp;
+	if(flag == 0) next += cast(i64, *next);
+    }
+    next++;
+    NEXT_POLL;
+
+op_lit_add:
+    check(DEPTH >= 1);
+    tos += *next++;
+    NEXT;
+
+op_dup_zero_branch:
+    check(DEPTH >= 1);
+    if(tos == 0) next += cast(i64, *next);
+    next++;
+    NEXT_POLL;
+
+op_nip:
+    check(DEPTH >= 2);
+    sp--;
+    NEXT;
+
+op_two_dup:
+    check(DEPTH >= 2 && DEPTH + 2 <= stack_max);
+    { u64 a = sp[-1]; *sp++ = tos; *sp++ = a; }
+    PEAK;
+    NEXT;
+
+op_dup:
+    check(DEPTH >= 1 && DEPTH < stack_max);
+    *sp++ = tos;
+    PEAK;
+    NEXT;
+
+op_over:
+    check(DEPTH >= 2 && DEPTH < stack_max);
+    *sp++ = tos;
+    tos = sp[-2];
+    PEAK;
+    NEXT;
+
+op_drop:
+    check(DEPTH >= 1);
+    tos = *--sp;
+    NEXT;
+
+op_swap:
+    check(DEPTH >= 2);
+    { u64 a = sp[-1]; sp[-1] = tos; tos = a; }
+    NEXT;
+
+op_add: BINARY(+);
+op_mult: BINARY(*);
+op_sub: BINARY(-);
+op_eq: BINARY(==);
+op_lt: BINARY(<);
+op_gt: BINARY(>);
+op_leq: BINARY(<=);
+op_geq: BINARY(>=);
+op_and: BINARY(&&);
+op_or: BINARY(||);
+
+op_not:
+    check(DEPTH >= 1);
+    tos = !tos;
+    NEXT;
+
+op_fetch:
+    check(DEPTH >= 1);
+    tos = *cast(u64*, tos);
+    NEXT;
+
+op_store:
+    check(DEPTH >= 2);
+    *cast(u64*, tos) = sp[-1];
+    sp -= 2;
+    tos = *sp;
+    NEXT;
+
+op_cfetch:
+    check(DEPTH >= 1);
+    tos = *cast(u8*, tos);
+    NEXT;
+
+op_cstore:
+    check(DEPTH >= 2);
+    *cast(u8*, tos) = sp[-1];
+    sp -= 2;
+    tos = *sp;
+    NEXT;
+
+#undef BINARY
+#undef PEAK
+#undef NEXT_POLL
+#undef NEXT
+#undef COUNT_DISPATCH
+#undef DISPATCH
+#undef DEPTH
+#undef HOT_OPS
+
+done:
+    *sp = tos;
+    SYNC_PEAKS;
+    f->current = current; f->next = next;
+    f->top_stack = sp + 1; f->top_rstack = rp;
+#undef SYNC_PEAKS
+}
+
+#endif
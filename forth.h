@@ -0,0 +1,428 @@
+#ifndef FORTH_H
+#define FORTH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <signal.h>
+
+/* 
+   An adaptation of JONESFORTH, written in C.  
+
+   I differ from usual FORTH conventions by using null-terminated
+   strings, # for comments, and more verbose words (e.g. code-word
+   instead of >CFA)
+
+   Anatomy of a forth word, stored in memory (in this order):
+   - 8 bytes :: pointer to the next word (or NULL if this is the next free word)
+   - 1 byte  :: some flags, to deal with immediate (not sure for now)
+   - word name (null terminated), and some padding to ensure 8-bytes
+     alignment
+   - 3 bytes :: the stack effect: cells taken + 1 (0 if unknown), cells
+     left, most cells pushed above the ones taken (see effect_bytes)
+   - 1 byte  :: the kind of the word (the id of its primitive, see
+     PRIMITIVES), as the last byte before the codeword
+   - 8 bytes :: codeword
+   - if forth word, nullptr terminated array of pointers to other words
+
+a solution:
+- a field "codeword", with type u8*
+- for C primitives: just a function pointer to the actual code to run
+- for forth words: a function pointer to the interpreting function,
+  which takes as input an array of pointers to forth words. It runs
+  all of them in sequence, until it reaches a null pointer (the end of
+  the array, equivalent to the NEXT macro in jonesforth)
+*/
+
+#define cast(type, val) ((type)(val))
+typedef uint8_t u8;
+typedef uint64_t u64;
+typedef int64_t i64;
+
+// stack depth checks of the primitives, compiled out by FORTH_UNCHECKED
+// (or NDEBUG); the stacks are surrounded by guard pages, so that
+// overflows still fault instead of corrupting memory
+#ifdef FORTH_UNCHECKED
+#define forth_check(cond) ((void)0)
+#else
+#define forth_check(cond) assert(cond)
+#endif
+
+#define IMMEDIATE_FLAG 0x1
+#define NOJIT_FLAG 0x2 // see nojit
+#define NOINLINE_FLAG 0x4 // see inline_word
+
+/*
+  Every C primitive registered by new_forth, in registration order. The
+  position in this list is the primitive id stored as the kind byte of
+  a word (0 being reserved for unknown primitives, e.g. the one added
+  through the C API).
+*/
+#define PRIMITIVES(X)						\
+    /* stack manipulation */					\
+    X(STACK_SIZE, "stack-size", 0, dostack_size)		\
+    X(DUP, "dup", 0, dodup)				\
+    X(OVER, "over", 0, over)					\
+    X(DROP, "drop", 0, drop)					\
+    X(SWAP, "swap", 0, swap)					\
+    /* arithmetic stuff */					\
+    X(ADD, "+", 0, add)						\
+    X(MULT, "*", 0, mult)					\
+    X(SUB, "-", 0, sub)						\
+    X(DIVMOD, "divmod", 0, divmod)				\
+    X(EQ, "=", 0, eq)						\
+    X(LT, "<", 0, lt)						\
+    X(GT, ">", 0, gt)						\
+    X(LEQ, "<=", 0, leq)					\
+    X(GEQ, ">=", 0, geq)					\
+    /* logical stuff */						\
+    X(NOT, "not", 0, donot)					\
+    X(AND, "and", 0, doand)					\
+    X(OR, "or", 0, door)					\
+								\
+    X(DOCOL, "docol", 0, docol)					\
+    X(EXIT, "exit", 0, doexit)					\
+    X(IS_COMPILING, "is-compiling", 0, is_compiling)		\
+    X(LBRACKET, "[", IMMEDIATE_FLAG, set_immediate_mode)	\
+    X(RBRACKET, "]", 0, set_compile_mode)			\
+    X(ERROR, "error", 0, doerror)				\
+    X(RUN_WORD, "run-word", 0, dorun_word)			\
+    X(CODE_WORD, "code-word", 0, docodeword)			\
+								\
+    X(KEY, "key", 0, key)					\
+    X(EMIT, "emit", 0, emit)					\
+    X(WORD, "word", 0, word)					\
+    X(TELL, "tell", 0, tell)					\
+    X(TYPE, "type", 0, type)					\
+    X(FLUSH, "flush", 0, doflush)				\
+    X(PARSE_NUMBER, "parse-number", 0, doparse_number)		\
+    X(FIND_WORD, "find-word", 0, dofind_word)			\
+    X(PARSE_NAME, "parse-name", 0, parse_name)			\
+    X(FIND_NAME, "find-name", 0, find_name)			\
+    X(STRING, "s\"", IMMEDIATE_FLAG, dostring)			\
+    X(COLON, ":", 0, colon)					\
+    X(SEMICOLON, ";", IMMEDIATE_FLAG, semicolon)		\
+    X(COMMA, ",", 0, comma)					\
+    X(ALLOT, "allot", 0, allot)					\
+    X(TICK, "'", 0, tick)					\
+    X(HERE, "here", 0, here)					\
+    X(LATEST, "latest", 0, latest)				\
+    X(INLINE_LIMIT, "inline-limit", 0, inline_limit)		\
+    X(BASE, "base", 0, dobase)					\
+    X(FETCH, "@", 0, fetch)					\
+    X(STORE, "!", 0, store)					\
+    X(CFETCH, "c@", 0, cfetch)					\
+    X(CSTORE, "c!", 0, cstore)					\
+    /* floating point, see float.c */				\
+    X(FADD, "f+", 0, fadd)					\
+    X(FSUB, "f-", 0, fsub)					\
+    X(FMULT, "f*", 0, fmult)					\
+    X(FDIV, "f/", 0, fdiv)					\
+    X(FSQRT, "fsqrt", 0, dofsqrt)				\
+    X(FEQ, "f=", 0, feq)					\
+    X(FLT, "f<", 0, flt)					\
+    X(INT_TO_FLOAT, "s>f", 0, int_to_float)			\
+    X(FLOAT_TO_INT, "f>s", 0, float_to_int)			\
+    X(VADD, "v+", 0, vadd)					\
+    X(VMULT, "v*", 0, vmult)					\
+    X(VSUM, "vsum", 0, vsum)					\
+    X(VDOT, "vdot", 0, vdot)					\
+    /* blocks of bytes, see mem.c */				\
+    X(CMOVE, "cmove", 0, cmove)					\
+    X(FILL, "fill", 0, fill)					\
+    X(COMPARE, "compare", 0, compare)				\
+    X(SEARCH, "search", 0, search)				\
+    X(ARENA_NEW, "arena-new", 0, arena_new)			\
+    X(ARENA_ALLOC, "arena-alloc", 0, arena_alloc)		\
+    X(ARENA_MARK, "arena-mark", 0, arena_mark)			\
+    X(ARENA_RELEASE, "arena-release", 0, arena_release)	\
+    X(ARENA_RESET, "arena-reset", 0, arena_reset)		\
+    X(ARENA_FREE, "arena-free", 0, arena_free)			\
+    /* strings, see str.c */					\
+    X(CONCAT, "concat", 0, concat)				\
+    X(SLICE, "slice", 0, slice)					\
+    X(HASH, "hash", 0, dohash)					\
+    X(TO_NUMBER, "s>number", 0, to_number)			\
+    X(NUMBER_TO_S, "number>s", 0, number_to_s)			\
+    /* tasks, see task.c */					\
+    X(SPAWN, "spawn", 0, spawn)					\
+    X(JOIN, "join", 0, join)					\
+    /* channels, see chan.c */					\
+    X(CHAN_NEW, "chan-new", 0, chan_new)			\
+    X(CHAN_NEW_SPSC, "chan-new-spsc", 0, chan_new_spsc)	\
+    X(CHAN_SEND, "chan-send", 0, chan_send)			\
+    X(CHAN_RECV, "chan-recv", 0, chan_recv)			\
+    X(CHAN_TRY_RECV, "chan-try-recv", 0, chan_try_recv)	\
+    X(CHAN_SEND_N, "chan-send-n", 0, chan_send_n)		\
+    X(CHAN_RECV_N, "chan-recv-n", 0, chan_recv_n)		\
+    X(CHAN_FREE, "chan-free", 0, chan_free)			\
+    /* coroutines, see coro.c */				\
+    X(TASK, "task", 0, task)					\
+    X(YIELD, "yield", 0, yield)					\
+    X(RUN_TASKS, "run-tasks", 0, run_tasks)			\
+    /* asynchronous I/O, see io.c */				\
+    X(TCP_LISTEN, "tcp-listen", 0, tcp_listen)			\
+    X(TCP_CONNECT, "tcp-connect", 0, tcp_connect)		\
+    X(ACCEPT, "accept", 0, doaccept)				\
+    X(READ_ASYNC, "read-async", 0, read_async)			\
+    X(WRITE_ASYNC, "write-async", 0, write_async)		\
+    X(CLOSE_FD, "close-fd", 0, close_fd)			\
+    X(FD_STREAM, "fd-stream", 0, fd_stream)			\
+    X(LIT, "lit", 0, lit)					\
+    X(LITSTRING, "litstring", 0, litstring)			\
+    X(BRANCH, "branch", 0, branch)				\
+    X(ZERO_BRANCH, "0branch", 0, zero_branch)			\
+    /* superinstructions, see fuse_thread */			\
+    X(LIT_ADD, "lit+", 0, lit_add)				\
+    X(DUP_ZERO_BRANCH, "dup0branch", 0, dup_zero_branch)	\
+    X(NIP, "nip", 0, nip)					\
+    X(TWO_DUP, "2dup", 0, two_dup)				\
+    X(TAIL_CALL, "tailcall", 0, tail_call)			\
+    X(IMMEDIATE, "immediate", IMMEDIATE_FLAG, immediate)	\
+    X(NOINLINE, "noinline", IMMEDIATE_FLAG, noinline)		\
+    X(NOJIT, "nojit", IMMEDIATE_FLAG, nojit)			\
+    X(STDIN, "stdin", 0, dostdin)				\
+    X(SET_INPUT_STREAM, "set-input-stream", 0, set_input_stream) \
+    X(GET_INPUT_STREAM, "get-input-stream", 0, get_input_stream) \
+    X(CLOSE_FILE, "close-file", 0, close_file)			\
+    X(OPEN_READ_FILE, "open-read-file", 0, open_read_file)	\
+    X(INCLUDE, "include", 0, include)				\
+    X(SAVE_IMAGE, "save-image", 0, dosave_image)		\
+								\
+    X(PRINTSTACK, ".s", 0, printstack)				\
+    X(PRINTFLOAT, "f.", 0, printfloat)				\
+    X(PRINTWORDS, ".w", 0, printwords)				\
+    X(DUMPWORDS, ".d", 0, dumpwords)				\
+    X(PRINTPROF, ".prof", 0, printprof)				\
+    X(RESETPROF, ".prof-reset", 0, resetprof)			\
+    /* metrics, see stats.c */					\
+    X(PRINTSTATS, ".stats", 0, printstats)			\
+    X(WRITE_STATS, "stats-write", 0, dowrite_stats)		\
+    X(STATS_EVERY, "stats-every", 0, dostats_every)
+
+#define PRIMITIVE_ID(id, name, flags, fn) PRIM_##id,
+enum { PRIM_NONE, PRIMITIVES(PRIMITIVE_ID) PRIM_COUNT };
+#undef PRIMITIVE_ID
+
+// the kind of colon definitions compiled to native code, see jit.c
+#define NATIVE_KIND 0xff
+
+typedef enum
+{
+    NORMAL_STATE, COMPILE_STATE
+} interp_state_t;
+
+struct forth_t;
+
+// an input source, read through its own buffer (see refill)
+typedef struct source_t
+{
+    FILE* file; // set-input-stream & co identify sources by their FILE*
+    char* buf;
+    size_t pos; // next char to read
+    size_t len; // end of the data read so far
+    size_t cap;
+    bool eof;
+    bool error;
+    bool mapped; // buf is the whole file, mmap'ed
+    bool tty; // the output is flushed before reading it, see repl
+    struct forth_t* forth; // which reads it, see wait_input
+
+    struct source_t* next; // other sources of the same forth
+} source_t;
+
+// sizes of the arrays of a forth, see new_forth_sized
+typedef struct
+{
+    size_t word_size; // in bytes
+    size_t stack_size; // in cells
+    size_t rstack_size; // in cells
+} forth_sizes_t;
+
+extern const forth_sizes_t default_sizes;
+
+#define TRACE_SIZE 32 // calls kept by the trace, a power of 2
+
+// dispatches are counted by the call threaded interpreter, and by the
+// others only when profiling or built with -DCOUNT_DISPATCHES: the
+// counter slows their tight loops down by up to a third
+#if !defined(COUNT_DISPATCHES) && (!defined(DIRECT_THREADED) || defined(FORTH_PROFILE))
+#define COUNT_DISPATCHES
+#endif
+
+// counters of a forth, cheap enough to be always on (see stats.c)
+typedef struct
+{
+    u64 dispatches; // codewords run by the inner interpreter
+    u64 calls; // words entered, see count_call
+    u64 stack_peak; // most cells on the stack, see note_peaks
+    u64 rstack_peak; // and on the return stack
+    u64 io_ns; // waiting for input, output or asynchronous I/O
+    u64 start_ns;
+    u64* trace[TRACE_SIZE]; // codewords of the last calls, by calls
+
+    // periodic dump, see stats-every
+    volatile sig_atomic_t due; // set by the timer, see stats_tick
+    int fd; // -1 for none
+    int format; // STATS_JSON or STATS_PROMETHEUS
+    void* timer; // a timer_t, NULL until the first stats-every
+} stats_t;
+
+typedef struct forth_t
+{
+    u8* words;
+    u64* pointers; // a bit per cell of words, see mark_cell
+    u64* stack;
+    u64* rstack;
+
+    // constants that dictate the size of the word array, the stack
+    // and the return stack
+    size_t word_size;
+    size_t stack_size;
+    size_t rstack_size;
+
+    // pointers to the top of the three stacks (i.e. the next free one)
+    u8* here;
+    u64* top_stack;
+    u64* top_rstack;
+
+    u8* latest; // last word defined (NULL if no word)
+    size_t word_count; // words from latest on, see push_header
+
+    struct forth_t* base; // whose words are shared, see fork_forth
+    bool frozen; // words are shared with forks, and read-only
+
+    // open-addressing hash index of the dictionary (name -> word),
+    // each slot pointing to the newest definition of that name
+    u8** index;
+    size_t index_size; // number of slots, always a power of 2
+    size_t index_count; // number of used slots
+
+    // by default stdin, but can be changed to i.e. read from a file
+    // or a string
+    FILE* input_stream;
+    FILE* output_stream; // by default stdout
+    struct sink_t* out; // its buffer, see out.c
+    source_t* input; // the source of input_stream
+    source_t* sources; // every source read so far
+
+    // where word copies its token
+    char* word_buf;
+    size_t word_cap;
+    
+    interp_state_t state;
+    jmp_buf* on_error; // of the innermost run_file, see forth_error
+
+    // numbers pushed and words run outside of definitions, but for :
+    // and immediate words; include only caches files that add none
+    u64 effects;
+    const char* cache_dir; // of include, NULL not to cache (see cache.c)
+
+    // codeword of each primitive, by id
+    u64* codewords[PRIM_COUNT];
+
+    u64 fused; // number of sequences replaced by fuse_thread
+    u64 inline_limit; // in cells, 0 to never inline (see inline_word)
+    u64 radix; // of the numbers read, see base and parse_number
+    u64 inlined; // number of calls replaced by inline_word
+
+    struct prof_t* prof; // see prof.c
+    stats_t stats;
+    struct arena_t* arenas; // see mem.c
+
+    // run spawned tasks, see task.c
+    struct pool_t* pool;
+    size_t workers; // threads of the pool, 0 for one per CPU
+    struct coros_t* coros; // see coro.c
+    struct io_t* io; // see io.c
+    bool epoll; // for asynchronous I/O, rather than io_uring
+
+    // native code of the words compiled by the JIT, see jit.c
+    u8* code;
+    size_t code_used;
+
+    // to match jonesforth's naming:
+    u64* next; // %esi
+    u64* current; // %eax
+} forth_t;
+
+typedef void prim_t(forth_t*);
+
+// creating a forth: new_forth defines the primitives only (see repl
+// and startup.f), clone_forth copies the dictionary of another one
+// (not of a fork: it returns NULL), and fork_forth shares it
+forth_t* new_forth();
+forth_t* new_forth_sized(const forth_sizes_t* sizes);
+forth_t* clone_forth(forth_t* base);
+forth_t* fork_forth(forth_t* base);
+void free_forth(forth_t* f);
+
+// interpret the input of f (see set_input) until its end; run_file
+// interprets a file, and recovers from its errors; include_file opens
+// path (-1 if it cannot), and goes through the cache of f
+void repl(forth_t* f);
+int run_file(forth_t* f, FILE* file);
+int include_file(forth_t* f, const char* path);
+void forth_error(forth_t* f, const char* message);
+void run_word(forth_t* f, u8* word);
+void run_codeword(forth_t* f, u64* cw);
+void set_input(forth_t* f, FILE* file);
+
+// inline, as every primitive uses them
+static inline u64 stack_size(forth_t* f) { return f->top_stack - f->stack; }
+static inline u64 rstack_size(forth_t* f) { return f->top_rstack - f->rstack; }
+
+static inline u64 pop(forth_t* f)
+{
+    forth_check(stack_size(f) > 0);
+    return *(--f->top_stack);
+}
+
+static inline void push(forth_t* f, u64 p)
+{
+    forth_check(stack_size(f) < f->stack_size);
+    *f->top_stack = p; ++(f->top_stack);
+}
+
+static inline u64 rpop(forth_t* f)
+{
+    forth_check(rstack_size(f) > 0);
+    return *(--f->top_rstack);
+}
+
+static inline void rpush(forth_t* f, u64 p)
+{
+    forth_check(rstack_size(f) < f->rstack_size);
+    *f->top_rstack = p; ++(f->top_rstack);
+}
+
+u8* find_word(forth_t* f, const char* name);
+u8* find_word_n(forth_t* f, const char* name, size_t len);
+u64* codeword(u8* word);
+u8* wordname(u8* word);
+u8* push_primitive_word(forth_t* f, const char* name, u8 flags, prim_t* primitive);
+u8* push_forth_word(forth_t* f, const char* name, u8 flags, u8** words);
+u8* push_forth_word_raw(forth_t* f, const char* name, u8 flags, u64* words);
+
+// the output of f, buffered (see out.c); print is a printf to it
+extern const size_t default_output_size;
+void set_output(forth_t* f, FILE* file, size_t size, bool async);
+void write_output(forth_t* f, const void* data, size_t len);
+void put_output(forth_t* f, char c);
+void print(forth_t* f, const char* fmt, ...);
+void flush_output(forth_t* f);
+
+bool save_image(forth_t* f, const char* path);
+
+// the counters of f written to fd, as a JSON object or in the text
+// format of Prometheus; stats_every does it every ms milliseconds (0
+// to stop), as f runs (see stats.c)
+enum { STATS_JSON, STATS_PROMETHEUS };
+void write_stats(forth_t* f, int fd, int format);
+void stats_every(forth_t* f, int fd, int format, u64 ms);
+forth_t* load_image(const char* path, const forth_sizes_t* sizes);
+
+#endif
@@ -0,0 +1,450 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+/*
+  Asynchronous I/O on descriptors, for the coroutines of coro.c: the
+  words below start an operation, and block the running coroutine
+  until it completes, the others running meanwhile (the interpreter
+  alone simply waits). Failures push -1.
+
+  tcp-listen ( port -- fd ) and tcp-connect ( host port -- fd ) make
+  IPv4 sockets (host is a dotted address), accept ( fd -- fd ) waits
+  for a connection, read-async ( addr len fd -- n ) for up to len
+  bytes (0 at the end), write-async ( addr len fd -- n ) writes them
+  all, and close-fd ( fd -- ) closes fd. fd-stream ( fd -- file ) makes
+  a stream that set-input-stream reads from, with key and word.
+
+  The operations go through io_uring where the kernel has it (with
+  fast poll, 5.7 on) and f->epoll is not set: they are queued to the
+  submission ring, submitted all at once when no coroutine can run,
+  and their completions wake the coroutines that wait for them. Else,
+  sockets are non-blocking, and an operation that would block waits
+  for its descriptor to be ready, through epoll (one coroutine at a
+  time per descriptor).
+*/
+
+#define RING_ENTRIES 256
+#define MAX_IO INT_MAX // bytes per read or write, as the ring takes 32 bits
+
+void* coro_running(forth_t* f);
+void coro_block(forth_t* f);
+void coro_wake(forth_t* f, void* c);
+bool coro_others(forth_t* f);
+u64 now_ns(void);
+void count_io(forth_t* f, u64 start);
+void stats_tick(forth_t* f);
+
+// of an operation, on the stack of the coroutine that waits for it
+typedef struct
+{
+    void* coro;
+    i64 res; // as the syscall would return it: -errno on failures
+    bool done;
+} waiter_t;
+
+typedef struct io_t
+{
+    bool uring;
+    size_t pending; // operations not reaped yet
+
+    int ring;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    struct io_uring_sqe* sqes;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map; // may be sq_map
+    size_t cq_map_size;
+    size_t unsubmitted;
+
+    int epoll;
+} io_t;
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static bool setup_ring(io_t* io)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int ring = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if(ring < 0) return false;
+    if(!(p.features & IORING_FEAT_FAST_POLL) || !(p.features & IORING_FEAT_NODROP))
+    {
+	close(ring);
+	return false;
+    }
+
+    io->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    io->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single && io->cq_map_size > io->sq_map_size) io->sq_map_size = io->cq_map_size;
+
+    io->sq_map = mmap(NULL, io->sq_map_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    io->cq_map = single ? io->sq_map :
+	mmap(NULL, io->cq_map_size, PROT_READ | PROT_WRITE,
+	     MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    io->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if(io->sq_map == MAP_FAILED || io->cq_map == MAP_FAILED || io->sqes == MAP_FAILED)
+    {
+	// the ring is only used once all three are mapped
+	if(io->sq_map != MAP_FAILED) munmap(io->sq_map, io->sq_map_size);
+	if(!single && io->cq_map != MAP_FAILED) munmap(io->cq_map, io->cq_map_size);
+	if(io->sqes != MAP_FAILED) munmap(io->sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+	close(ring);
+	return false;
+    }
+
+    u8* sq = io->sq_map;
+    u8* cq = io->cq_map;
+    io->ring = ring;
+    io->sq_entries = p.sq_entries;
+    io->cq_entries = p.cq_entries;
+    io->sq_head = cast(uint32_t*, sq + p.sq_off.head);
+    io->sq_tail = cast(uint32_t*, sq + p.sq_off.tail);
+    io->sq_mask = cast(uint32_t*, sq + p.sq_off.ring_mask);
+    io->sq_array = cast(uint32_t*, sq + p.sq_off.array);
+    io->cq_head = cast(uint32_t*, cq + p.cq_off.head);
+    io->cq_tail = cast(uint32_t*, cq + p.cq_off.tail);
+    io->cq_mask = cast(uint32_t*, cq + p.cq_off.ring_mask);
+    io->cqes = cast(struct io_uring_cqe*, cq + p.cq_off.cqes);
+    return true;
+}
+
+static io_t* get_io(forth_t* f)
+{
+    if(f->io) return f->io;
+
+    io_t* io = calloc(1, sizeof(io_t));
+    io->ring = io->epoll = -1;
+    io->uring = !f->epoll && setup_ring(io);
+    if(!io->uring) io->epoll = epoll_create1(EPOLL_CLOEXEC);
+    f->io = io;
+    return io;
+}
+
+// by free_forth: the operations still pending are dropped
+void free_io(forth_t* f)
+{
+    io_t* io = f->io;
+    if(!io) return;
+
+    if(io->uring)
+    {
+	munmap(io->sqes, io->sq_entries * sizeof(struct io_uring_sqe));
+	if(io->cq_map != io->sq_map) munmap(io->cq_map, io->cq_map_size);
+	munmap(io->sq_map, io->sq_map_size);
+	close(io->ring);
+    }
+    else close(io->epoll);
+    free(io);
+    f->io = NULL;
+}
+
+static int enter(io_t* io, uint32_t submit, uint32_t complete, uint32_t flags)
+{
+    int n;
+    do n = syscall(__NR_io_uring_enter, io->ring, submit, complete, flags, NULL, 0);
+    while(n < 0 && errno == EINTR);
+    return n;
+}
+
+/*
+  Wake the coroutines whose operations completed, first waiting for
+  one if block and none did; false if no operation is pending.
+*/
+bool io_wait(forth_t* f, bool block)
+{
+    io_t* io = f->io;
+    if(!io || io->pending == 0) return false;
+
+    if(!io->uring)
+    {
+	struct epoll_event events[64];
+	int n;
+	u64 start = now_ns();
+	do n = epoll_wait(io->epoll, events, 64, block ? -1 : 0);
+	while(n < 0 && errno == EINTR);
+	count_io(f, start);
+	for(int i = 0 ; i < n ; ++i)
+	{
+	    waiter_t* w = events[i].data.ptr;
+	    w->res = events[i].events;
+	    w->done = true;
+	    coro_wake(f, w->coro);
+	    io->pending--;
+	}
+	stats_tick(f);
+	return true;
+    }
+
+    uint32_t head = *io->cq_head;
+    bool ready = head != LOAD(io->cq_tail);
+    if(io->unsubmitted > 0 || (block && !ready))
+    {
+	u64 start = now_ns();
+	int n = enter(io, io->unsubmitted, block && !ready, block && !ready ? IORING_ENTER_GETEVENTS : 0);
+	if(n > 0) io->unsubmitted -= n;
+	count_io(f, start);
+    }
+
+    uint32_t tail = LOAD(io->cq_tail);
+    for(; head != tail ; ++head)
+    {
+	struct io_uring_cqe* cqe = &io->cqes[head & *io->cq_mask];
+	waiter_t* w = cast(waiter_t*, cast(uintptr_t, cqe->user_data));
+	w->res = cqe->res;
+	w->done = true;
+	coro_wake(f, w->coro);
+	io->pending--;
+    }
+    STORE(io->cq_head, head);
+    stats_tick(f);
+    return true;
+}
+
+// a zeroed entry of the submission ring, to fill and pass to submit
+static struct io_uring_sqe* new_sqe(forth_t* f, io_t* io)
+{
+    // the completions of every pending operation must fit
+    while(io->pending >= io->cq_entries) io_wait(f, true);
+
+    uint32_t tail = *io->sq_tail;
+    if(tail - LOAD(io->sq_head) == io->sq_entries)
+    {
+	int n = enter(io, io->unsubmitted, 0, 0);
+	if(n > 0) io->unsubmitted -= n;
+    }
+
+    uint32_t i = tail & *io->sq_mask;
+    struct io_uring_sqe* sqe = &io->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    io->sq_array[i] = i;
+    return sqe;
+}
+
+// queue sqe, and wait for its completion
+static i64 submit(forth_t* f, io_t* io, struct io_uring_sqe* sqe)
+{
+    waiter_t w = { coro_running(f), 0, false };
+    sqe->user_data = cast(u64, cast(uintptr_t, &w));
+    STORE(io->sq_tail, *io->sq_tail + 1);
+    io->unsubmitted++;
+    io->pending++;
+    while(!w.done) coro_block(f);
+    return w.res;
+}
+
+// until fd is ready for events (POLLIN or POLLOUT)
+static void wait_ready(forth_t* f, int fd, uint32_t events)
+{
+    io_t* io = get_io(f);
+    if(io->uring)
+    {
+	struct io_uring_sqe* sqe = new_sqe(f, io);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	submit(f, io, sqe);
+	return;
+    }
+
+    waiter_t w = { coro_running(f), 0, false };
+    struct epoll_event ev = { .events = events | EPOLLONESHOT, .data.ptr = &w };
+    if(epoll_ctl(io->epoll, EPOLL_CTL_MOD, fd, &ev) < 0
+       && (errno != ENOENT || epoll_ctl(io->epoll, EPOLL_CTL_ADD, fd, &ev) < 0))
+	return; // e.g. a regular file, always ready
+    io->pending++;
+    while(!w.done) coro_block(f);
+}
+
+/*
+  By refill, before reading the descriptor fd of an input of f: if
+  other coroutines can run meanwhile, or always if block (fd is
+  non-blocking, and read said it would), wait for it to be readable.
+*/
+void wait_input(forth_t* f, int fd, bool block)
+{
+    if(!block && !coro_others(f)) return;
+
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    if(poll(&p, 1, 0) > 0) return;
+    wait_ready(f, fd, POLLIN);
+}
+
+/*
+  Run the operation opcode on fd (as the syscall would, for epoll),
+  retrying it once fd is ready for events when it would block and
+  after signals. Returns its result, -1 on failures.
+*/
+static i64 io_op(forth_t* f, u8 opcode, int fd, u64 addr, uint32_t len, uint32_t events)
+{
+    io_t* io = get_io(f);
+    while(true)
+    {
+	i64 res;
+	if(io->uring)
+	{
+	    struct io_uring_sqe* sqe = new_sqe(f, io);
+	    sqe->opcode = opcode;
+	    sqe->fd = fd;
+	    sqe->addr = addr;
+	    sqe->off = opcode == IORING_OP_CONNECT ? len : cast(u64, -1);
+	    sqe->len = opcode == IORING_OP_CONNECT ? 0 : len;
+	    if(opcode == IORING_OP_ACCEPT) sqe->accept_flags = SOCK_CLOEXEC;
+	    res = submit(f, io, sqe);
+	}
+	else
+	{
+	    switch(opcode)
+	    {
+	    case IORING_OP_READ: res = read(fd, cast(void*, addr), len); break;
+	    case IORING_OP_WRITE: res = write(fd, cast(void*, addr), len); break;
+	    case IORING_OP_ACCEPT: res = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC); break;
+	    default: res = connect(fd, cast(struct sockaddr*, addr), len);
+	    }
+	    if(res < 0) res = -errno;
+	}
+
+	if(res == -EINTR) continue;
+	if(res == -EAGAIN || (res == -EINPROGRESS && opcode == IORING_OP_CONNECT))
+	{
+	    wait_ready(f, fd, events);
+	    if(opcode != IORING_OP_CONNECT) continue;
+
+	    int error = 0;
+	    socklen_t size = sizeof(error);
+	    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size);
+	    return error ? -1 : 0;
+	}
+	return res < 0 ? -1 : res;
+    }
+}
+
+// a TCP socket, blocking for io_uring (which polls it anyway)
+static int new_socket(forth_t* f)
+{
+    int flags = SOCK_CLOEXEC | (get_io(f)->uring ? 0 : SOCK_NONBLOCK);
+    return socket(AF_INET, SOCK_STREAM | flags, 0);
+}
+
+// ( port -- fd )
+void tcp_listen(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(pop(f)) };
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int fd = new_socket(f), one = 1;
+    if(fd >= 0)
+    {
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(bind(fd, cast(struct sockaddr*, &addr), sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+	{
+	    close(fd);
+	    fd = -1;
+	}
+    }
+    push(f, cast(u64, cast(i64, fd)));
+}
+
+// ( host port -- fd )
+void tcp_connect(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(pop(f)) };
+    const char* host = cast(const char*, pop(f));
+
+    int fd = -1;
+    if(inet_pton(AF_INET, host, &addr.sin_addr) == 1 && (fd = new_socket(f)) >= 0
+       && io_op(f, IORING_OP_CONNECT, fd, cast(u64, &addr), sizeof(addr), POLLOUT) < 0)
+    {
+	close(fd);
+	fd = -1;
+    }
+    push(f, cast(u64, cast(i64, fd)));
+}
+
+// ( fd -- fd )
+void doaccept(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    int fd = pop(f);
+    int client = io_op(f, IORING_OP_ACCEPT, fd, 0, 0, POLLIN);
+    push(f, cast(u64, cast(i64, client)));
+}
+
+// ( addr len fd -- n )
+void read_async(forth_t* f)
+{
+    check(stack_size(f) >= 3);
+    int fd = pop(f);
+    u64 len = pop(f);
+    u64 addr = pop(f);
+    if(len > MAX_IO) len = MAX_IO; // a shorter read, as it may be anyway
+    push(f, cast(u64, io_op(f, IORING_OP_READ, fd, addr, len, POLLIN)));
+}
+
+// ( addr len fd -- n )
+void write_async(forth_t* f)
+{
+    check(stack_size(f) >= 3);
+    int fd = pop(f);
+    u64 len = pop(f);
+    u64 addr = pop(f);
+
+    u64 done = 0;
+    while(done < len)
+    {
+	u64 part = len - done < MAX_IO ? len - done : MAX_IO;
+	i64 n = io_op(f, IORING_OP_WRITE, fd, addr + done, part, POLLOUT);
+	if(n <= 0)
+	{
+	    push(f, cast(u64, cast(i64, -1)));
+	    return;
+	}
+	done += n;
+    }
+    push(f, done);
+}
+
+// ( fd -- )
+void close_fd(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    close(pop(f));
+}
+
+// ( fd -- file )
+void fd_stream(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    push(f, cast(u64, fdopen(pop(f), "r")));
+}
@@ -0,0 +1,578 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "forth.h"
+
+/*
+  The JIT (FORTH_JIT builds, x86-64 only): semicolon translates the
+  thread of the new colon definition to a native function, which takes
+  the place of its codeword (kind NATIVE_KIND), so that threads and
+  both inner interpreters call it like any other primitive. The thread
+  itself is kept, to decode the word (see relocate_words and
+  save_image) or compile it again (see jit_words).
+
+  In the native code, rbx holds f, r12 the slot of the top of the stack
+  and r13 its value (as in the direct threaded run_word), and r14 the
+  f->next of the caller, given back on return. The stack and control
+  flow primitives are inlined, other primitives and native words are
+  called after syncing f->top_stack (a tailcall being a call, then a
+  return, but for a jump to the start of a recursive word), and colon definitions that could
+  not be compiled are run by run_codeword. Like FORTH_UNCHECKED builds,
+  the native code only relies on the guard pages of the stacks, but
+  for the depth a word of known stack effect needs, and the room for
+  what it pushes, checked on entry (see bad_entry).
+  Each word also counts and traces its calls (see stats.c), as docol
+  does, keeps the peak depth of the stack, and polls the timer of the
+  periodic dump (see emit_poll). r15 counts down the backward jumps.
+
+  A thread is not compiled when it cannot be decoded, or uses run-word
+  (which changes the control flow of its caller), nor when the word has
+  the NOJIT_FLAG (see nojit).
+*/
+
+// reserved for the native code of each forth, see new_region
+#define JIT_ARENA_SIZE (1ul << 26)
+
+void docol(forth_t* f);
+void run_codeword(forth_t* f, u64* cw);
+u64* codeword(u8* word);
+u8* wordtag(u8* word);
+u8 codeword_kind(u64* cw);
+size_t operands(u64* ip);
+bool is_branch(u64* cw);
+bool is_codeword(forth_t* f, u64* p);
+size_t thread_length(forth_t* f, u64* body, u64* end);
+u8* effect_bytes(u64* cw);
+void stack_error(forth_t* f, u64* cw);
+void stats_tick(forth_t* f);
+
+#ifdef FORTH_JIT
+
+#ifndef __x86_64__
+#error "the JIT only targets x86-64"
+#endif
+
+typedef struct
+{
+    u8* start; // of the function
+    u8* p; // where to emit
+    u64* cw; // of the word being compiled
+    u8** polls; // where each call of emit_poll goes on, see emit_polls
+    size_t npolls;
+} jit_t;
+
+#define EMIT(j, ...) emit_bytes((j), (u8[]){ __VA_ARGS__ }, sizeof((u8[]){ __VA_ARGS__ }))
+
+static void emit_bytes(jit_t* j, const u8* bytes, size_t n)
+{
+    memcpy(j->p, bytes, n);
+    j->p += n;
+}
+
+static void emit32(jit_t* j, int32_t v) { memcpy(j->p, &v, 4); j->p += 4; }
+static void emit64(jit_t* j, u64 v) { memcpy(j->p, &v, 8); j->p += 8; }
+
+static bool fits32(i64 v) { return v == cast(int32_t, v); }
+
+#define DISP32(field) cast(int32_t, offsetof(forth_t, field))
+
+// *sp = tos; f->top_stack = sp + 1
+static void emit_spill(jit_t* j)
+{
+    EMIT(j, 0x4D, 0x89, 0x2C, 0x24); // mov [r12], r13
+    EMIT(j, 0x49, 0x8D, 0x44, 0x24, 0x08); // lea rax, [r12 + 8]
+    EMIT(j, 0x48, 0x89, 0x83); emit32(j, DISP32(top_stack)); // mov [rbx + top_stack], rax
+}
+
+// sp = f->top_stack - 1; tos = *sp
+static void emit_reload(jit_t* j)
+{
+    EMIT(j, 0x4C, 0x8B, 0xA3); emit32(j, DISP32(top_stack)); // mov r12, [rbx + top_stack]
+    EMIT(j, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+    EMIT(j, 0x4D, 0x8B, 0x2C, 0x24); // mov r13, [r12]
+}
+
+static void emit_push(jit_t* j)
+{
+    EMIT(j, 0x4D, 0x89, 0x2C, 0x24); // mov [r12], r13
+    EMIT(j, 0x49, 0x83, 0xC4, 0x08); // add r12, 8
+}
+
+static void emit_pop(jit_t* j)
+{
+    EMIT(j, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+    EMIT(j, 0x4D, 0x8B, 0x2C, 0x24); // mov r13, [r12]
+}
+
+static void emit_set_tos(jit_t* j, u64 v)
+{
+    if(fits32(v)) { EMIT(j, 0x49, 0xC7, 0xC5); emit32(j, v); } // mov r13, imm32
+    else { EMIT(j, 0x49, 0xBD); emit64(j, v); } // mov r13, imm64
+}
+
+// tos = a setcc tos, where a is below it
+static void emit_compare(jit_t* j, u8 setcc)
+{
+    EMIT(j, 0x49, 0x8B, 0x44, 0x24, 0xF8); // mov rax, [r12 - 8]
+    EMIT(j, 0x4C, 0x39, 0xE8); // cmp rax, r13
+    EMIT(j, 0x0F, setcc, 0xC0); // setcc al
+    EMIT(j, 0x44, 0x0F, 0xB6, 0xE8); // movzx r13d, al
+    EMIT(j, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+}
+
+static void emit_logical(jit_t* j, u8 op)
+{
+    EMIT(j, 0x49, 0x8B, 0x44, 0x24, 0xF8); // mov rax, [r12 - 8]
+    EMIT(j, 0x48, 0x85, 0xC0); // test rax, rax
+    EMIT(j, 0x0F, 0x95, 0xC0); // setne al
+    EMIT(j, 0x4D, 0x85, 0xED); // test r13, r13
+    EMIT(j, 0x0F, 0x95, 0xC1); // setne cl
+    EMIT(j, op, 0xC8); // and/or al, cl
+    EMIT(j, 0x44, 0x0F, 0xB6, 0xE8); // movzx r13d, al
+    EMIT(j, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+}
+
+// the setcc opcode of a comparison primitive, 0 for the others
+static u8 setcc(u8 kind)
+{
+    switch(kind)
+    {
+    case PRIM_EQ: return 0x94;
+    case PRIM_LT: return 0x9C;
+    case PRIM_GT: return 0x9F;
+    case PRIM_LEQ: return 0x9E;
+    case PRIM_GEQ: return 0x9D;
+    default: return 0;
+    }
+}
+
+/*
+  f->stats.stack_peak = max(f->stats.stack_peak, depth + up), see
+  stats_t, the depth being that of the cached top (r12) or, in the
+  prologue, of f->top_stack
+*/
+static void emit_peak(jit_t* j, bool prologue, int32_t up)
+{
+    if(prologue)
+    {
+	EMIT(j, 0x48, 0x8B, 0x83); emit32(j, DISP32(top_stack)); // mov rax, [rbx + top_stack]
+    }
+    else
+    {
+	EMIT(j, 0x49, 0x8D, 0x44, 0x24, 0x08); // lea rax, [r12 + 8]
+    }
+    EMIT(j, 0x48, 0x2B, 0x83); emit32(j, DISP32(stack)); // sub rax, [rbx + stack]
+    EMIT(j, 0x48, 0xC1, 0xF8, 0x03); // sar rax, 3
+    if(up) { EMIT(j, 0x48, 0x05); emit32(j, up); } // add rax, imm32
+    EMIT(j, 0x48, 0x3B, 0x83); emit32(j, DISP32(stats.stack_peak)); // cmp rax, [rbx + stack_peak]
+    EMIT(j, 0x76, 0x07); // jbe over the store
+    EMIT(j, 0x48, 0x89, 0x83); emit32(j, DISP32(stats.stack_peak)); // mov [rbx + stack_peak], rax
+}
+
+#define POLL_EVERY 1024 // calls, or backward jumps, a power of 2
+
+/*
+  Call stats_tick if the timer is due, every POLL_EVERY calls (in the
+  prologue, edx holding f->stats.calls) or backward jumps (counted down
+  by r15): the code that looks at the timer is out of line (see
+  emit_polls), so that the loops only pay for a decrement.
+*/
+static void emit_poll(jit_t* j, bool prologue)
+{
+    if(prologue)
+    {
+	EMIT(j, 0xF7, 0xC2); emit32(j, POLL_EVERY - 1); // test edx, imm32
+    }
+    else EMIT(j, 0x41, 0xFF, 0xCF); // dec r15d
+    EMIT(j, 0x0F, 0x84); emit32(j, 0); // jz rel32, patched
+    j->polls[j->npolls++] = j->p;
+}
+
+// the code of each emit_poll, at the end of the function; in the
+// prologue (the first one), f is synced already
+static void emit_polls(jit_t* j)
+{
+    for(size_t k = 0 ; k < j->npolls ; ++k)
+    {
+	u8* back = j->polls[k];
+	int32_t rel = j->p - back;
+	memcpy(back - 4, &rel, 4);
+
+	bool prologue = k == 0;
+	if(!prologue) { EMIT(j, 0x41, 0xBF); emit32(j, POLL_EVERY); } // mov r15d, imm32
+	EMIT(j, 0x83, 0xBB); emit32(j, DISP32(stats.due)); EMIT(j, 0x00); // cmp dword [rbx + due], 0
+	EMIT(j, 0x0F, 0x84); emit32(j, back - (j->p + 4)); // je back
+	if(!prologue) emit_spill(j);
+	EMIT(j, 0x48, 0x89, 0xDF); // mov rdi, rbx
+	EMIT(j, 0x48, 0xB8); emit64(j, cast(u64, stats_tick)); // mov rax, stats_tick
+	EMIT(j, 0xFF, 0xD0); // call rax
+	if(!prologue) emit_reload(j);
+	EMIT(j, 0xE9); emit32(j, back - (j->p + 4)); // jmp back
+    }
+}
+
+// run a colon definition that was not compiled, from native code
+static void jit_enter(forth_t* f, u64* cw)
+{
+    u64* next = f->next;
+    u64* current = f->current;
+    run_codeword(f, cw);
+    f->next = next;
+    f->current = current;
+}
+
+// call the codeword cw (a primitive, or a word compiled or not)
+static void emit_call(jit_t* j, u64* cw)
+{
+    emit_spill(j);
+    EMIT(j, 0x48, 0x89, 0xDF); // mov rdi, rbx
+    if(cw == j->cw)
+    {
+	// recursion: the codeword is set once compiled
+	EMIT(j, 0xE8); emit32(j, j->start - (j->p + 4)); // call start
+    }
+    else if(codeword_kind(cw) == PRIM_DOCOL)
+    {
+	EMIT(j, 0x48, 0xBE); emit64(j, cast(u64, cw)); // mov rsi, cw
+	EMIT(j, 0x48, 0xB8); emit64(j, cast(u64, jit_enter)); // mov rax, jit_enter
+	EMIT(j, 0xFF, 0xD0); // call rax
+    }
+    else
+    {
+	EMIT(j, 0x48, 0xB8); emit64(j, cast(u64, cw)); // mov rax, cw
+	EMIT(j, 0xFF, 0x10); // call [rax]
+    }
+    emit_reload(j);
+}
+
+/*
+  Compile the thread of word (a colon definition), which ends before
+  end, and make the native code its codeword. Returns whether it was
+  compiled.
+*/
+bool jit_word(forth_t* f, u8* word, u8* end)
+{
+    u64* cw = codeword(word);
+    if((*wordtag(word) & NOJIT_FLAG) || codeword_kind(cw) != PRIM_DOCOL) return false;
+
+    u64* body = cw + 1;
+    size_t n = thread_length(f, body, cast(u64*, end));
+    if(n == 0) return false;
+
+    // (generously) large enough for any thread of n cells
+    size_t bound = 64 * n + 320;
+    if(!f->code)
+    {
+	f->code = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(f->code == MAP_FAILED) { f->code = NULL; return false; }
+	f->code_used = 0;
+    }
+    if(f->code_used + bound > JIT_ARENA_SIZE) return false;
+
+    enum { START = 0x1, TARGET = 0x2 };
+    u8* marks = calloc(n + 1, 1);
+    u8** at = malloc((n + 1) * sizeof(u8*)); // native code of each cell
+    size_t* jumps = malloc(n * sizeof(size_t)); // cells of the branches
+    u8** patches = malloc(n * sizeof(u8*)); // their rel32
+    size_t njumps = 0;
+
+    for(size_t i = 0 ; i < n ; i += 1 + operands(body + i))
+    {
+	marks[i] |= START;
+	if(is_branch(cast(u64*, body[i])))
+	    marks[i + 2 + cast(i64, body[i + 1])] |= TARGET;
+    }
+    marks[n] |= START;
+    bool ok = true;
+    for(size_t i = 0 ; i <= n ; ++i)
+	if((marks[i] & TARGET) && !(marks[i] & START)) ok = false;
+
+    jit_t j = { f->code + f->code_used, f->code + f->code_used, cw, malloc((n + 1) * sizeof(u8*)), 0 };
+
+    // prologue: 5 pushes keep the stack aligned for calls
+    EMIT(&j, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57); // push rbx, r12-r15
+    EMIT(&j, 0x48, 0x89, 0xFB); // mov rbx, rdi
+
+    // with a known stack effect, the depth it needs and the room for
+    // what it pushes are checked once
+    u8* bad[2] = { NULL, NULL };
+    u8* e = effect_bytes(cw);
+    if(e[0] && (e[0] > 1 || e[2] > 0))
+    {
+	EMIT(&j, 0x48, 0x8B, 0x83); emit32(&j, DISP32(top_stack)); // mov rax, [rbx + top_stack]
+	EMIT(&j, 0x48, 0x2B, 0x83); emit32(&j, DISP32(stack)); // sub rax, [rbx + stack]
+    }
+    if(e[0] > 1)
+    {
+	EMIT(&j, 0x48, 0x3D); emit32(&j, 8 * (e[0] - 1)); // cmp rax, imm32
+	EMIT(&j, 0x0F, 0x8C); // jl rel32
+	bad[0] = j.p; emit32(&j, 0);
+    }
+    if(e[0] && e[2] > 0)
+    {
+	EMIT(&j, 0x48, 0x8D, 0x90); emit32(&j, 8 * e[2]); // lea rdx, [rax + imm32]
+	EMIT(&j, 0x48, 0x8B, 0x8B); emit32(&j, DISP32(stack_size)); // mov rcx, [rbx + stack_size]
+	EMIT(&j, 0x48, 0xC1, 0xE1, 0x03); // shl rcx, 3
+	EMIT(&j, 0x48, 0x39, 0xCA); // cmp rdx, rcx
+	EMIT(&j, 0x0F, 0x87); // ja rel32
+	bad[1] = j.p; emit32(&j, 0);
+    }
+
+    // f->stats.trace[f->stats.calls++ % TRACE_SIZE] = cw, see count_call
+    EMIT(&j, 0x48, 0x8B, 0x83); emit32(&j, DISP32(stats.calls)); // mov rax, [rbx + calls]
+    EMIT(&j, 0x48, 0x8D, 0x50, 0x01); // lea rdx, [rax + 1]
+    EMIT(&j, 0x48, 0x89, 0x93); emit32(&j, DISP32(stats.calls)); // mov [rbx + calls], rdx
+    EMIT(&j, 0x83, 0xE0, TRACE_SIZE - 1); // and eax, TRACE_SIZE - 1
+    EMIT(&j, 0x48, 0xB9); emit64(&j, cast(u64, cw)); // mov rcx, cw
+    EMIT(&j, 0x48, 0x89, 0x8C, 0xC3); emit32(&j, DISP32(stats.trace)); // mov [rbx + rax * 8 + trace], rcx
+    emit_poll(&j, true);
+    EMIT(&j, 0x41, 0xBF); emit32(&j, POLL_EVERY); // mov r15d, POLL_EVERY
+
+    // with a known stack effect, the peak of the whole body (callees
+    // included) is known on entry, else it is kept at each push
+    bool known = e[0] != 0;
+    if(known) emit_peak(&j, true, e[2]);
+
+    EMIT(&j, 0x4C, 0x8B, 0xB3); emit32(&j, DISP32(next)); // mov r14, [rbx + next]
+    emit_reload(&j);
+
+    for(size_t i = 0 ; ok && i < n ; )
+    {
+	u64* cw = cast(u64*, body[i]);
+	u8 kind = codeword_kind(cw);
+	u64 operand = operands(body + i) ? body[i + 1] : 0;
+	size_t len = 1 + operands(body + i);
+	at[i] = j.p;
+
+	// lit followed by a comparison: compare with an immediate
+	u8 cc = i + len < n && !(marks[i + len] & TARGET) ?
+	    setcc(codeword_kind(cast(u64*, body[i + len]))) : 0;
+	if(kind == PRIM_LIT && cc && fits32(operand))
+	{
+	    EMIT(&j, 0x49, 0x81, 0xFD); emit32(&j, operand); // cmp r13, imm32
+	    EMIT(&j, 0x0F, cc, 0xC0); // setcc al
+	    EMIT(&j, 0x44, 0x0F, 0xB6, 0xE8); // movzx r13d, al
+	    at[i + len] = j.p;
+	    i += len + 1;
+	    continue;
+	}
+
+	switch(kind)
+	{
+	case PRIM_LIT: case PRIM_TICK:
+	    emit_push(&j);
+	    emit_set_tos(&j, operand);
+	    if(!known) emit_peak(&j, false, 0);
+	    break;
+	case PRIM_LITSTRING: // its chars stay in the thread
+	    emit_push(&j);
+	    emit_set_tos(&j, cast(u64, body + i + 2));
+	    emit_push(&j);
+	    emit_set_tos(&j, operand);
+	    if(!known) emit_peak(&j, false, 0);
+	    break;
+	case PRIM_LIT_ADD:
+	    if(fits32(operand)) { EMIT(&j, 0x49, 0x81, 0xC5); emit32(&j, operand); } // add r13, imm32
+	    else
+	    {
+		EMIT(&j, 0x48, 0xB8); emit64(&j, operand); // mov rax, imm64
+		EMIT(&j, 0x49, 0x01, 0xC5); // add r13, rax
+	    }
+	    break;
+	case PRIM_DUP:
+	    emit_push(&j);
+	    if(!known) emit_peak(&j, false, 0);
+	    break;
+	case PRIM_DROP: emit_pop(&j); break;
+	case PRIM_NIP: EMIT(&j, 0x49, 0x83, 0xEC, 0x08); break; // sub r12, 8
+	case PRIM_SWAP:
+	    EMIT(&j, 0x49, 0x8B, 0x44, 0x24, 0xF8); // mov rax, [r12 - 8]
+	    EMIT(&j, 0x4D, 0x89, 0x6C, 0x24, 0xF8); // mov [r12 - 8], r13
+	    EMIT(&j, 0x49, 0x89, 0xC5); // mov r13, rax
+	    break;
+	case PRIM_OVER:
+	    emit_push(&j);
+	    EMIT(&j, 0x4D, 0x8B, 0x6C, 0x24, 0xF0); // mov r13, [r12 - 16]
+	    if(!known) emit_peak(&j, false, 0);
+	    break;
+	case PRIM_TWO_DUP:
+	    EMIT(&j, 0x49, 0x8B, 0x44, 0x24, 0xF8); // mov rax, [r12 - 8]
+	    EMIT(&j, 0x4D, 0x89, 0x2C, 0x24); // mov [r12], r13
+	    EMIT(&j, 0x49, 0x89, 0x44, 0x24, 0x08); // mov [r12 + 8], rax
+	    EMIT(&j, 0x49, 0x83, 0xC4, 0x10); // add r12, 16
+	    if(!known) emit_peak(&j, false, 0);
+	    break;
+	case PRIM_ADD:
+	    EMIT(&j, 0x4D, 0x03, 0x6C, 0x24, 0xF8); // add r13, [r12 - 8]
+	    EMIT(&j, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+	    break;
+	case PRIM_MULT:
+	    EMIT(&j, 0x4D, 0x0F, 0xAF, 0x6C, 0x24, 0xF8); // imul r13, [r12 - 8]
+	    EMIT(&j, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+	    break;
+	case PRIM_SUB:
+	    EMIT(&j, 0x49, 0x8B, 0x44, 0x24, 0xF8); // mov rax, [r12 - 8]
+	    EMIT(&j, 0x4C, 0x29, 0xE8); // sub rax, r13
+	    EMIT(&j, 0x49, 0x89, 0xC5); // mov r13, rax
+	    EMIT(&j, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+	    break;
+	case PRIM_EQ: case PRIM_LT: case PRIM_GT: case PRIM_LEQ: case PRIM_GEQ:
+	    emit_compare(&j, setcc(kind));
+	    break;
+	case PRIM_AND: emit_logical(&j, 0x20); break;
+	case PRIM_OR: emit_logical(&j, 0x08); break;
+	case PRIM_NOT:
+	    EMIT(&j, 0x4D, 0x85, 0xED); // test r13, r13
+	    EMIT(&j, 0x0F, 0x94, 0xC0); // sete al
+	    EMIT(&j, 0x44, 0x0F, 0xB6, 0xE8); // movzx r13d, al
+	    break;
+	case PRIM_FETCH: EMIT(&j, 0x4D, 0x8B, 0x6D, 0x00); break; // mov r13, [r13]
+	case PRIM_STORE:
+	    EMIT(&j, 0x49, 0x8B, 0x44, 0x24, 0xF8); // mov rax, [r12 - 8]
+	    EMIT(&j, 0x49, 0x89, 0x45, 0x00); // mov [r13], rax
+	    EMIT(&j, 0x49, 0x83, 0xEC, 0x10); // sub r12, 16
+	    EMIT(&j, 0x4D, 0x8B, 0x2C, 0x24); // mov r13, [r12]
+	    break;
+	case PRIM_CFETCH: EMIT(&j, 0x45, 0x0F, 0xB6, 0x6D, 0x00); break; // movzx r13d, byte [r13]
+	case PRIM_CSTORE:
+	    EMIT(&j, 0x49, 0x8B, 0x44, 0x24, 0xF8); // mov rax, [r12 - 8]
+	    EMIT(&j, 0x41, 0x88, 0x45, 0x00); // mov [r13], al
+	    EMIT(&j, 0x49, 0x83, 0xEC, 0x10); // sub r12, 16
+	    EMIT(&j, 0x4D, 0x8B, 0x2C, 0x24); // mov r13, [r12]
+	    break;
+	case PRIM_BRANCH:
+	    if(cast(i64, operand) < 0) emit_poll(&j, false);
+	    EMIT(&j, 0xE9); // jmp rel32
+	    jumps[njumps] = i + 2 + cast(i64, operand);
+	    patches[njumps++] = j.p; emit32(&j, 0);
+	    break;
+	case PRIM_ZERO_BRANCH:
+	    if(cast(i64, operand) < 0) emit_poll(&j, false);
+	    EMIT(&j, 0x4C, 0x89, 0xE8); // mov rax, r13
+	    emit_pop(&j);
+	    EMIT(&j, 0x48, 0x85, 0xC0); // test rax, rax
+	    EMIT(&j, 0x0F, 0x84); // jz rel32
+	    jumps[njumps] = i + 2 + cast(i64, operand);
+	    patches[njumps++] = j.p; emit32(&j, 0);
+	    break;
+	case PRIM_DUP_ZERO_BRANCH:
+	    if(cast(i64, operand) < 0) emit_poll(&j, false);
+	    EMIT(&j, 0x4D, 0x85, 0xED); // test r13, r13
+	    EMIT(&j, 0x0F, 0x84); // jz rel32
+	    jumps[njumps] = i + 2 + cast(i64, operand);
+	    patches[njumps++] = j.p; emit32(&j, 0);
+	    break;
+	case PRIM_TAIL_CALL:
+	    if(cast(u64*, operand) == j.cw)
+	    {
+		// recursion: a jump to the start of the body
+		emit_poll(&j, false);
+		EMIT(&j, 0xE9); // jmp rel32
+		jumps[njumps] = 0;
+		patches[njumps++] = j.p; emit32(&j, 0);
+		break;
+	    }
+	    emit_call(&j, cast(u64*, operand));
+	    if(i + 3 == n) break; // the last exit follows
+	    EMIT(&j, 0xE9); // jmp rel32
+	    jumps[njumps] = n;
+	    patches[njumps++] = j.p; emit32(&j, 0);
+	    break;
+	case PRIM_EXIT:
+	    if(i + 1 == n) break; // the epilogue follows
+	    EMIT(&j, 0xE9); // jmp rel32
+	    jumps[njumps] = n;
+	    patches[njumps++] = j.p; emit32(&j, 0);
+	    break;
+	default:
+	    emit_call(&j, cw);
+	}
+	i += len;
+    }
+    at[n] = j.p;
+
+    // epilogue
+    emit_spill(&j);
+    EMIT(&j, 0x4C, 0x89, 0xB3); emit32(&j, DISP32(next)); // mov [rbx + next], r14
+    EMIT(&j, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3); // pop r15-r12, rbx; ret
+
+    if(bad[0] || bad[1])
+    {
+	for(int k = 0 ; k < 2 ; ++k)
+	{
+	    if(!bad[k]) continue;
+	    int32_t rel = j.p - (bad[k] + 4);
+	    memcpy(bad[k], &rel, 4);
+	}
+	EMIT(&j, 0x48, 0x89, 0xDF); // mov rdi, rbx
+	EMIT(&j, 0x48, 0xBE); emit64(&j, cast(u64, cw)); // mov rsi, cw
+	EMIT(&j, 0x48, 0xB8); emit64(&j, cast(u64, stack_error)); // mov rax, stack_error
+	EMIT(&j, 0xFF, 0xD0); // call rax, which does not return
+    }
+    emit_polls(&j);
+
+    for(size_t k = 0 ; ok && k < njumps ; ++k)
+    {
+	int32_t rel = at[jumps[k]] - (patches[k] + 4);
+	memcpy(patches[k], &rel, 4);
+    }
+
+    if(ok)
+    {
+	f->code_used = j.p - f->code;
+	f->code_used = (f->code_used + 15) & ~cast(size_t, 15);
+	*cw = cast(u64, j.start);
+	cast(u8*, cw)[-1] = NATIVE_KIND;
+    }
+
+    free(marks);
+    free(at);
+    free(jumps);
+    free(patches);
+    free(j.polls);
+    return ok;
+}
+
+/*
+  Compile every colon definition of f (oldest first, so that calls to
+  compiled words are direct), e.g. after loading an image; words that
+  were compiled by another forth (see clone_forth) are compiled again.
+*/
+void jit_words(forth_t* f)
+{
+    size_t n = 0;
+    for(u8* w = f->latest ; w >= f->words && w < f->here ; w = *cast(u8**, w)) n++;
+    u8** words = malloc(n * sizeof(u8*));
+    size_t i = n;
+    for(u8* w = f->latest ; w >= f->words && w < f->here ; w = *cast(u8**, w)) words[--i] = w;
+
+    for(i = 0 ; i < n ; ++i)
+    {
+	u64* cw = codeword(words[i]);
+	if(codeword_kind(cw) == NATIVE_KIND)
+	{
+	    *cw = cast(u64, docol);
+	    cast(u8*, cw)[-1] = PRIM_DOCOL;
+	}
+	jit_word(f, words[i], i + 1 < n ? words[i + 1] : f->here);
+    }
+    free(words);
+}
+
+void free_jit(forth_t* f)
+{
+    if(f->code) munmap(f->code, JIT_ARENA_SIZE);
+}
+
+#else
+
+bool jit_word(forth_t* f, u8* word, u8* end) { return false; }
+void jit_words(forth_t* f) {}
+void free_jit(forth_t* f) {}
+
+#endif
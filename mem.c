@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+u8* new_region(size_t size, void* hint);
+void free_region(u8* region, size_t size);
+
+/*
+  Words on blocks of bytes, given as an address and a length: cmove,
+  fill and compare are memmove, memset and memcmp (which the C library
+  already dispatches to its SSE2/AVX2 versions at run time), search
+  scans for the first and last bytes of the pattern with SSE2 or AVX2,
+  picked when first used.
+*/
+
+// ( src dst len -- ) copy len bytes, even if the blocks overlap
+void cmove(forth_t* f)
+{
+    check(stack_size(f) >= 3);
+    u64 len = pop(f);
+    u8* dst = cast(u8*, pop(f));
+    u8* src = cast(u8*, pop(f));
+    memmove(dst, src, len);
+}
+
+// ( addr len byte -- )
+void fill(forth_t* f)
+{
+    check(stack_size(f) >= 3);
+    u8 byte = pop(f);
+    u64 len = pop(f);
+    memset(cast(u8*, pop(f)), byte, len);
+}
+
+// ( addr1 len1 addr2 len2 -- n ) -1, 0 or 1 as the first block is
+// before, the same as or after the second one (a prefix is before)
+void compare(forth_t* f)
+{
+    check(stack_size(f) >= 4);
+    u64 len2 = pop(f);
+    u8* p2 = cast(u8*, pop(f));
+    u64 len1 = pop(f);
+    u8* p1 = cast(u8*, pop(f));
+
+    int c = memcmp(p1, p2, len1 < len2 ? len1 : len2);
+    if(c == 0) c = len1 < len2 ? -1 : len1 > len2;
+    push(f, cast(u64, cast(i64, c < 0 ? -1 : c > 0)));
+}
+
+static u8* search_scalar(u8* p, size_t len, const u8* pat, size_t n)
+{
+    for(u8* end = p + len - n + 1 ; p < end ; ++p)
+    {
+	p = memchr(p, pat[0], end - p);
+	if(!p) return NULL;
+	if(p[n - 1] == pat[n - 1] && memcmp(p, pat, n) == 0) return p;
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+// candidates are where both the first and the last bytes match, W at
+// a time, the rest is left to search_scalar
+#define SEARCH_KERNEL(name, isa, vec, W, set1, load, cmpeq, movemask) \
+    __attribute__((target(isa)))					\
+    static u8* name(u8* p, size_t len, const u8* pat, size_t n)	\
+    {									\
+	const vec first = set1(pat[0]);				\
+	const vec last = set1(pat[n - 1]);				\
+	size_t i = 0;							\
+	for(; i + n - 1 + W <= len ; i += W)				\
+	{								\
+	    vec a = load(cast(const vec*, p + i));			\
+	    vec b = load(cast(const vec*, p + i + n - 1));		\
+	    unsigned mask = movemask(cmpeq(a, first)) & movemask(cmpeq(b, last)); \
+	    for(; mask ; mask &= mask - 1)				\
+	    {								\
+		u8* q = p + i + __builtin_ctz(mask);			\
+		if(memcmp(q + 1, pat + 1, n - 2) == 0) return q;	\
+	    }								\
+	}								\
+	return search_scalar(p + i, len - i, pat, n);			\
+    }
+
+SEARCH_KERNEL(search_sse2, "sse2", __m128i, 16, _mm_set1_epi8,
+	      _mm_loadu_si128, _mm_cmpeq_epi8, _mm_movemask_epi8)
+SEARCH_KERNEL(search_avx2, "avx2", __m256i, 32, _mm256_set1_epi8,
+	      _mm256_loadu_si256, _mm256_cmpeq_epi8, _mm256_movemask_epi8)
+
+static u8* search_any(u8* p, size_t len, const u8* pat, size_t n);
+static u8* (*search_kernel)(u8*, size_t, const u8*, size_t) = search_any;
+
+static u8* search_any(u8* p, size_t len, const u8* pat, size_t n)
+{
+    __builtin_cpu_init();
+    search_kernel = __builtin_cpu_supports("avx2") ? search_avx2 : search_sse2;
+    return search_kernel(p, len, pat, n);
+}
+
+#else
+#define search_kernel search_scalar
+#endif
+
+// the first occurrence of n bytes at pat in len bytes at p, or NULL
+u8* search_bytes(u8* p, size_t len, const u8* pat, size_t n)
+{
+    if(n == 0) return p;
+    if(n > len) return NULL;
+    if(n == 1) return memchr(p, pat[0], len);
+    return search_kernel(p, len, pat, n);
+}
+
+// ( addr1 len1 addr2 len2 -- addr3 len3 flag ) look for the second
+// block in the first one: flag is 1 and addr3 len3 is the rest of the
+// first block from there if found, else 0 with the first block
+void search(forth_t* f)
+{
+    check(stack_size(f) >= 4);
+    u64 n = pop(f);
+    u8* pat = cast(u8*, pop(f));
+    u64 len = f->top_stack[-1];
+    u8* p = cast(u8*, f->top_stack[-2]);
+
+    u8* found = search_bytes(p, len, pat, n);
+    if(found)
+    {
+	f->top_stack[-2] = cast(u64, found);
+	f->top_stack[-1] = len - (found - p);
+    }
+    push(f, found != NULL);
+}
+
+/*
+  Arenas, for data that does not belong in the dictionary: a region
+  (see new_region) handed out by bumping a pointer, 8 byte aligned, and
+  given back all at once by arena-reset, or down to a mark by
+  arena-release. The arenas of a forth not freed by arena-free are by
+  free_forth, so the scratch memory of a job goes with it.
+*/
+typedef struct arena_t
+{
+    u8* base;
+    u8* top; // next free byte
+    u8* end;
+    struct arena_t* next; // other arenas of the same forth
+} arena_t;
+
+// ( size -- arena )
+void arena_new(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    size_t size = pop(f);
+    arena_t* a = malloc(sizeof(arena_t));
+    a->base = a->top = new_region(size, NULL);
+    a->end = a->base + size;
+    a->next = f->arenas;
+    f->arenas = a;
+    push(f, cast(u64, a));
+}
+
+// ( arena n -- addr )
+void arena_alloc(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64 n = pop(f);
+    arena_t* a = cast(arena_t*, pop(f));
+    u8* p = cast(u8*, (cast(u64, a->top) + 7) & ~7ull);
+    if(p > a->end || n > cast(u64, a->end - p)) forth_error(f, "[arena full]");
+    a->top = p + n;
+    push(f, cast(u64, p));
+}
+
+// ( arena -- mark ) and ( arena mark -- ): free what was allocated
+// since the mark
+void arena_mark(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    push(f, cast(u64, cast(arena_t*, pop(f))->top));
+}
+
+void arena_release(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u8* mark = cast(u8*, pop(f));
+    arena_t* a = cast(arena_t*, pop(f));
+    check(mark >= a->base && mark <= a->top);
+    a->top = mark;
+}
+
+// ( arena -- )
+void arena_reset(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    arena_t* a = cast(arena_t*, pop(f));
+    a->top = a->base;
+}
+
+// ( arena -- )
+void arena_free(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    arena_t* a = cast(arena_t*, pop(f));
+    arena_t** p = &f->arenas;
+    while(*p && *p != a) p = &(*p)->next;
+    if(!*p) forth_error(f, "[not an arena]");
+
+    *p = a->next;
+    free_region(a->base, a->end - a->base);
+    free(a);
+}
+
+void free_arenas(forth_t* f)
+{
+    while(f->arenas)
+    {
+	arena_t* a = f->arenas;
+	f->arenas = a->next;
+	free_region(a->base, a->end - a->base);
+	free(a);
+    }
+}
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "forth.h"
+
+/*
+  The output of a forth: emit, tell, type and the words printing
+  reports fill a buffer, written to f->output_stream when full and by
+  flush_output (the flush word, errors, reading a terminal and
+  free_forth). When the stream has a file descriptor, the buffer goes
+  to it with write, bypassing stdio and its lock; otherwise (e.g.
+  fmemopen) through fwrite.
+
+  With an async sink (see set_output), full buffers are queued to a
+  writer thread instead, which writes every queued one with a single
+  writev: the interpreter only waits for it when all SINK_BUFFERS are
+  queued, and in flush_output, which returns once everything is
+  written. The descriptor of an async sink is the one of the stream
+  given to set_output, while otherwise f->output_stream can be changed
+  at any time (the buffer goes to the stream set when it is written).
+*/
+
+#define SINK_BUFFERS 4
+
+typedef struct sink_t
+{
+    char* buf; // being filled, one of bufs
+    size_t len;
+    size_t cap;
+
+    FILE** file; // &f->output_stream
+    int fd; // of the stream of an async sink
+
+    // async only: bufs[head] to bufs[head + count - 1] (mod
+    // SINK_BUFFERS) are queued, buf is the one after them
+    bool async;
+    char* bufs[SINK_BUFFERS];
+    size_t lens[SINK_BUFFERS];
+    size_t head;
+    size_t count;
+    bool stop;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} sink_t;
+
+const size_t default_output_size = 1 << 16;
+
+u64 now_ns(void);
+void count_io(forth_t* f, u64 start);
+
+// write everything, dropping the data on errors (e.g. a closed pipe)
+static void write_all(int fd, struct iovec* iov, int n)
+{
+    while(n > 0)
+    {
+	ssize_t done = writev(fd, iov, n);
+	if(done < 0 && errno == EINTR) continue;
+	if(done < 0) return;
+
+	for(; n > 0 && cast(size_t, done) >= iov->iov_len ; iov++, n--)
+	    done -= iov->iov_len;
+	if(n > 0)
+	{
+	    iov->iov_base = cast(char*, iov->iov_base) + done;
+	    iov->iov_len -= done;
+	}
+    }
+}
+
+static void* writer(void* arg)
+{
+    sink_t* s = arg;
+    pthread_mutex_lock(&s->lock);
+    while(true)
+    {
+	while(s->count == 0 && !s->stop) pthread_cond_wait(&s->changed, &s->lock);
+	if(s->count == 0) break;
+
+	size_t n = s->count;
+	struct iovec iov[SINK_BUFFERS];
+	for(size_t i = 0 ; i < n ; ++i)
+	{
+	    size_t k = (s->head + i) % SINK_BUFFERS;
+	    iov[i].iov_base = s->bufs[k];
+	    iov[i].iov_len = s->lens[k];
+	}
+	pthread_mutex_unlock(&s->lock);
+	write_all(s->fd, iov, n);
+	pthread_mutex_lock(&s->lock);
+
+	s->head = (s->head + n) % SINK_BUFFERS;
+	s->count -= n;
+	pthread_cond_broadcast(&s->changed);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// of a sink that is not async
+static void write_now(sink_t* s, const void* data, size_t len)
+{
+    int fd = fileno(*s->file);
+    if(fd < 0) fwrite(data, 1, len, *s->file);
+    else
+    {
+	struct iovec iov = { cast(void*, data), len };
+	write_all(fd, &iov, 1);
+    }
+}
+
+// hand the buffer of f over, leaving an empty one
+static void drain(forth_t* f)
+{
+    sink_t* s = f->out;
+    if(s->len == 0) return;
+
+    u64 start = now_ns();
+    if(!s->async)
+    {
+	write_now(s, s->buf, s->len);
+	s->len = 0;
+	count_io(f, start);
+	return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    while(s->count == SINK_BUFFERS - 1) pthread_cond_wait(&s->changed, &s->lock);
+    size_t k = (s->head + s->count) % SINK_BUFFERS;
+    s->lens[k] = s->len;
+    s->count++;
+    s->buf = s->bufs[(k + 1) % SINK_BUFFERS];
+    s->len = 0;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    count_io(f, start);
+}
+
+static void free_sink(sink_t* s)
+{
+    if(s->async)
+    {
+	pthread_mutex_lock(&s->lock);
+	s->stop = true;
+	pthread_cond_broadcast(&s->changed);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->writer, NULL);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->changed);
+	for(size_t i = 0 ; i < SINK_BUFFERS ; ++i) free(s->bufs[i]);
+    }
+    else free(s->buf);
+    free(s);
+}
+
+void flush_output(forth_t* f)
+{
+    sink_t* s = f->out;
+    drain(f);
+
+    if(s->async)
+    {
+	u64 start = now_ns();
+	pthread_mutex_lock(&s->lock);
+	while(s->count > 0) pthread_cond_wait(&s->changed, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	count_io(f, start);
+    }
+    else if(fileno(*s->file) < 0) fflush(*s->file);
+}
+
+/*
+  Write the output of f to file, through a buffer of size bytes, and
+  from a writer thread if async (only for files with a descriptor).
+  What was written before goes to the previous file first.
+*/
+void set_output(forth_t* f, FILE* file, size_t size, bool async)
+{
+    if(f->out)
+    {
+	flush_output(f);
+	free_sink(f->out);
+    }
+
+    sink_t* s = calloc(1, sizeof(sink_t));
+    f->output_stream = file;
+    s->cap = size ? size : 1;
+    s->file = &f->output_stream;
+    s->fd = fileno(file);
+    s->async = async && s->fd >= 0;
+    fflush(file); // what stdio holds for it comes first
+
+    if(s->async)
+    {
+	for(size_t i = 0 ; i < SINK_BUFFERS ; ++i) s->bufs[i] = malloc(s->cap);
+	s->buf = s->bufs[0];
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->changed, NULL);
+	if(pthread_create(&s->writer, NULL, writer, s) != 0)
+	{
+	    for(size_t i = 1 ; i < SINK_BUFFERS ; ++i) free(s->bufs[i]);
+	    s->async = false;
+	}
+    }
+    else s->buf = malloc(s->cap);
+
+    f->out = s;
+}
+
+// the same output as base, with a buffer of its own
+void inherit_output(forth_t* f, forth_t* base)
+{
+    set_output(f, base->output_stream, base->out->cap, base->out->async);
+}
+
+void free_output(forth_t* f)
+{
+    flush_output(f);
+    free_sink(f->out);
+    f->out = NULL;
+}
+
+void write_output(forth_t* f, const void* data, size_t len)
+{
+    sink_t* s = f->out;
+    if(!s->async && len >= s->cap) // not worth copying
+    {
+	drain(f);
+	u64 start = now_ns();
+	write_now(s, data, len);
+	count_io(f, start);
+	return;
+    }
+
+    while(len > s->cap - s->len)
+    {
+	size_t n = s->cap - s->len;
+	memcpy(s->buf + s->len, data, n);
+	s->len += n;
+	data = cast(const char*, data) + n;
+	len -= n;
+	drain(f);
+    }
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+}
+
+void put_output(forth_t* f, char c)
+{
+    sink_t* s = f->out;
+    if(s->len == s->cap) drain(f);
+    s->buf[s->len++] = c;
+}
+
+void print(forth_t* f, const char* fmt, ...)
+{
+    char small[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, args);
+    va_end(args);
+    if(n < 0) return;
+    if(cast(size_t, n) < sizeof(small))
+    {
+	write_output(f, small, n);
+	return;
+    }
+
+    char* big = malloc(n + 1);
+    va_start(args, fmt);
+    vsnprintf(big, n + 1, fmt, args);
+    va_end(args);
+    write_output(f, big, n);
+    free(big);
+}
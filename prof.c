@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "forth.h"
+
+/*
+  The profiler (FORTH_PROFILE builds): both inner interpreters count
+  the dispatches of each codeword (prof_dispatch), and time colon
+  definitions from docol to exit (prof_enter and prof_exit, cycles
+  including the words they call). The codewords of the running colon
+  definitions are kept on a shadow of the return stack, which the
+  SIGPROF handler copies (with the codeword being dispatched) every
+  PROF_INTERVAL_US of CPU time; samples give the time spent in each
+  word (self) and below it (total). Reports are printed by .prof, and
+  .prof-reset starts over.
+*/
+
+#define PROF_INTERVAL_US 1000
+#define PROF_SAMPLES (1 << 16)
+#define PROF_FRAMES 16 // deepest frames kept by a sample
+
+u64* codeword(u8* word);
+u8* wordname(u8* word);
+
+#ifdef FORTH_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static u64 cycles() { return __rdtsc(); }
+#else
+static u64 cycles()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+#endif
+
+typedef struct
+{
+    u64* cw; // NULL for an empty slot
+    u64 calls;
+    u64 cycles;
+    u64 self; // samples
+    u64 total;
+} prof_entry_t;
+
+typedef struct prof_t
+{
+    // open-addressing hash table, by codeword
+    prof_entry_t* table;
+    size_t size; // always a power of 2
+    size_t count;
+
+    // running colon definitions, as their codewords and start time
+    struct { u64* cw; u64 start; }* frames;
+    size_t max_depth;
+    volatile size_t depth;
+    u64* volatile current; // codeword being dispatched
+
+    u64* (*samples)[PROF_FRAMES]; // innermost first, NULL terminated
+    volatile size_t nsamples;
+} prof_t;
+
+// the forth run by this thread, for the SIGPROF handler
+static __thread forth_t* running;
+
+static void prof_sample(int sig)
+{
+    forth_t* f = running;
+    if(!f || !f->prof) return;
+    prof_t* p = f->prof;
+
+    size_t n = p->nsamples;
+    if(n >= PROF_SAMPLES) return;
+
+    u64** sample = p->samples[n];
+    size_t k = 0;
+    if(p->current) sample[k++] = p->current;
+    for(size_t d = p->depth ; d > 0 && k < PROF_FRAMES ; --d)
+	sample[k++] = p->frames[d - 1].cw;
+    if(k < PROF_FRAMES) sample[k] = NULL;
+    p->nsamples = n + 1;
+}
+
+// once per process: every thread running a forth is sampled
+static void start_sampler()
+{
+    static volatile int started = 0;
+    if(!__sync_bool_compare_and_swap(&started, 0, 1)) return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = prof_sample;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    struct itimerval timer = { { 0, PROF_INTERVAL_US }, { 0, PROF_INTERVAL_US } };
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void prof_init(forth_t* f)
+{
+    prof_t* p = calloc(1, sizeof(prof_t));
+    p->size = 256;
+    p->table = calloc(p->size, sizeof(prof_entry_t));
+    p->max_depth = f->rstack_size;
+    p->frames = malloc(p->max_depth * sizeof(*p->frames));
+    p->samples = malloc(PROF_SAMPLES * sizeof(*p->samples));
+    f->prof = p;
+    start_sampler();
+}
+
+void prof_free(forth_t* f)
+{
+    prof_t* p = f->prof;
+    if(running == f) running = NULL;
+    free(p->table);
+    free(p->frames);
+    free(p->samples);
+    free(p);
+}
+
+static prof_entry_t* lookup(prof_entry_t* table, size_t size, u64* cw)
+{
+    size_t mask = size - 1;
+    size_t i = (cast(u64, cw) >> 3) * 0x9e3779b97f4a7c15ull >> 32 & mask;
+    while(table[i].cw && table[i].cw != cw) i = (i + 1) & mask;
+    return &table[i];
+}
+
+static prof_entry_t* entry(prof_t* p, u64* cw)
+{
+    prof_entry_t* e = lookup(p->table, p->size, cw);
+    if(e->cw) return e;
+
+    if(2 * (p->count + 1) > p->size)
+    {
+	size_t size = 2 * p->size;
+	prof_entry_t* table = calloc(size, sizeof(prof_entry_t));
+	for(size_t i = 0 ; i < p->size ; ++i)
+	    if(p->table[i].cw) *lookup(table, size, p->table[i].cw) = p->table[i];
+	free(p->table);
+	p->table = table;
+	p->size = size;
+	e = lookup(p->table, p->size, cw);
+    }
+    e->cw = cw;
+    p->count++;
+    return e;
+}
+
+void prof_dispatch(forth_t* f, u64* cw)
+{
+    running = f;
+    f->stats.dispatches++;
+    f->prof->current = cw;
+    entry(f->prof, cw)->calls++;
+}
+
+void prof_enter(forth_t* f, u64* cw)
+{
+    prof_t* p = f->prof;
+    if(p->depth == p->max_depth) return;
+    p->frames[p->depth].cw = cw;
+    p->frames[p->depth].start = cycles();
+    p->depth++;
+}
+
+void prof_exit(forth_t* f)
+{
+    prof_t* p = f->prof;
+    if(p->depth == 0) return;
+    size_t d = p->depth - 1;
+    entry(p, p->frames[d].cw)->cycles += cycles() - p->frames[d].start;
+    p->depth = d;
+}
+
+static int by_self(const void* a, const void* b)
+{
+    const prof_entry_t* x = a;
+    const prof_entry_t* y = b;
+    if(x->self != y->self) return x->self < y->self ? 1 : -1;
+    return x->calls < y->calls ? 1 : x->calls > y->calls ? -1 : 0;
+}
+
+// the name of the word of codeword cw, as defined in f
+static const char* name_of(forth_t* f, u64* cw)
+{
+    for(u8* w = f->latest ; w ; w = *cast(u8**, w))
+	if(codeword(w) == cw) return cast(const char*, wordname(w));
+    return NULL;
+}
+
+void printprof(forth_t* f)
+{
+    prof_t* p = f->prof;
+
+    // attribute the samples, counting each word once per sample
+    size_t nsamples = p->nsamples;
+    for(size_t n = 0 ; n < nsamples ; ++n)
+    {
+	u64** sample = p->samples[n];
+	for(size_t k = 0 ; k < PROF_FRAMES && sample[k] ; ++k)
+	{
+	    bool seen = false;
+	    for(size_t i = 0 ; i < k ; ++i) seen |= sample[i] == sample[k];
+	    prof_entry_t* e = entry(p, sample[k]);
+	    if(k == 0) e->self++;
+	    if(!seen) e->total++;
+	}
+    }
+    p->nsamples = 0;
+
+    size_t count = 0;
+    prof_entry_t* sorted = malloc(p->count * sizeof(prof_entry_t));
+    for(size_t i = 0 ; i < p->size ; ++i)
+	if(p->table[i].cw) sorted[count++] = p->table[i];
+    qsort(sorted, count, sizeof(prof_entry_t), by_self);
+
+    print(f, "%-20s %12s %16s %8s %8s\n", "word", "calls", "cycles", "self", "total");
+    for(size_t i = 0 ; i < count ; ++i)
+    {
+	const char* name = name_of(f, sorted[i].cw);
+	if(name) print(f, "%-20s", name);
+	else print(f, "%-20p", cast(void*, sorted[i].cw));
+	print(f, " %12" PRIu64 " %16" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+		sorted[i].calls, sorted[i].cycles, sorted[i].self, sorted[i].total);
+    }
+    free(sorted);
+}
+
+void resetprof(forth_t* f)
+{
+    prof_t* p = f->prof;
+    memset(p->table, 0, p->size * sizeof(prof_entry_t));
+    p->count = 0;
+    p->nsamples = 0;
+}
+
+#else
+
+void prof_init(forth_t* f) {}
+void prof_free(forth_t* f) {}
+
+void printprof(forth_t* f)
+{
+    print(f, "[not a profiling build, see FORTH_PROFILE]\n");
+}
+
+void resetprof(forth_t* f) {}
+
+#endif
@@ -2,6 +2,10 @@
 : / divmod drop ;
 : % divmod swap drop ;
 
+# bases of the numbers read and written
+: hex 16 base ! ;
+: decimal 10 base ! ;
+
 # control structures
 : if immediate
      ' 0branch ,
@@ -88,4 +92,3 @@
   stdin set-input-stream
 ;
 
-close-and-stdin
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+/*
+  The metrics of a forth, kept by every build: docol counts the calls
+  of colon definitions in f->stats (as does the native code of the
+  words compiled by the JIT, see jit.c), run_word the ones of the
+  primitives run by the interpreter, and the inner interpreters their
+  dispatches (see COUNT_DISPATCHES); docol (see note_peaks), the pushes
+  inlined by the direct threaded interpreter and the native code keep
+  the peak depth of the stacks, which is also taken when the metrics
+  are read; refill, io_wait and the output time their system calls.
+  push_header counts the words, and the bytes of the dictionary are
+  found when the metrics are read.
+
+  .stats ( -- ) prints them, stats-write ( fd format -- ) writes them
+  to fd, as a line of JSON (format 0) or in the text format of
+  Prometheus (1), and stats-every ( fd format ms -- ) does so every ms
+  milliseconds (0 to stop): a timer of the forth sets stats.due, which
+  the inner interpreters (and the native code) poll at calls and
+  branches, and refill and io_wait after waiting.
+
+  The codewords of the last TRACE_SIZE calls are kept in a ring, printed
+  to stderr by error, by stack errors and by failed assertions (from a
+  SIGABRT handler, unless the program has one).
+*/
+
+u64* codeword(u8* word);
+u8* wordname(u8* word);
+
+// the forth run by this thread, for the SIGABRT handler
+__thread forth_t* running_forth;
+
+u64 now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// by what timed an I/O operation, from start on
+void count_io(forth_t* f, u64 start) { f->stats.io_ns += now_ns() - start; }
+
+// the name of the word of codeword cw, as defined in f
+static const char* name_of(forth_t* f, u64* cw)
+{
+    for(u8* w = f->latest ; w ; w = *cast(u8**, w))
+	if(codeword(w) == cw) return cast(const char*, wordname(w));
+    return NULL;
+}
+
+// the last calls of f, oldest first
+void print_trace(forth_t* f)
+{
+    stats_t* s = &f->stats;
+    u64 n = s->calls < TRACE_SIZE ? s->calls : TRACE_SIZE;
+    fprintf(stderr, "[last calls:");
+    for(u64 i = s->calls - n ; i < s->calls ; ++i)
+    {
+	u64* cw = s->trace[i % TRACE_SIZE];
+	const char* name = name_of(f, cw);
+	if(name) fprintf(stderr, " %s", name);
+	else fprintf(stderr, " %p", cast(void*, cw));
+    }
+    fprintf(stderr, "]\n");
+}
+
+// the program is about to die anyway: no need to be signal-safe
+static void trace_abort(int sig)
+{
+    if(running_forth) print_trace(running_forth);
+}
+
+// once per process, then abort goes on as it would have
+static void catch_aborts()
+{
+    static volatile int caught = 0;
+    if(!__sync_bool_compare_and_swap(&caught, 0, 1)) return;
+
+    struct sigaction sa;
+    if(sigaction(SIGABRT, NULL, &sa) < 0 || sa.sa_handler != SIG_DFL) return;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_abort;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGABRT, &sa, NULL);
+}
+
+// the signal of the timers of stats_every
+#define STATS_SIGNAL (SIGRTMIN + 1)
+
+static void stats_due(int sig, siginfo_t* info, void* context)
+{
+    cast(stats_t*, info->si_value.sival_ptr)->due = 1;
+}
+
+// once per process, for the timer of any forth
+static void catch_stats_signal()
+{
+    static volatile int caught = 0;
+    if(!__sync_bool_compare_and_swap(&caught, 0, 1)) return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = stats_due;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART; // system calls go on
+    sigemptyset(&sa.sa_mask);
+    sigaction(STATS_SIGNAL, &sa, NULL);
+}
+
+void stats_init(forth_t* f)
+{
+    f->stats.fd = -1;
+    f->stats.start_ns = now_ns();
+    catch_aborts();
+}
+
+// deleting the timer also drops its signal, if it is pending
+void stats_free(forth_t* f)
+{
+    if(f->stats.timer)
+    {
+	timer_delete(*cast(timer_t*, f->stats.timer));
+	free(f->stats.timer);
+	f->stats.timer = NULL;
+    }
+    if(running_forth == f) running_forth = NULL;
+}
+
+enum { COUNTER, GAUGE, SECONDS }; // SECONDS counts nanoseconds
+
+typedef struct
+{
+    const char* name;
+    int kind;
+    u64 value;
+} metric_t;
+
+#define MAX_METRICS 16
+
+// the metrics of f in m, returns how many
+static size_t collect(forth_t* f, metric_t* m)
+{
+    stats_t* s = &f->stats;
+    if(stack_size(f) > s->stack_peak) s->stack_peak = stack_size(f);
+    if(rstack_size(f) > s->rstack_peak) s->rstack_peak = rstack_size(f);
+    u64 elapsed = now_ns() - s->start_ns;
+    u64 io = s->io_ns < elapsed ? s->io_ns : elapsed;
+
+    size_t n = 0;
+#ifdef COUNT_DISPATCHES
+    m[n++] = (metric_t) { "dispatches", COUNTER, s->dispatches };
+#endif
+    m[n++] = (metric_t) { "calls", COUNTER, s->calls };
+    m[n++] = (metric_t) { "words", GAUGE, f->word_count };
+    m[n++] = (metric_t) { "dictionary_bytes", GAUGE, f->here - f->words };
+    m[n++] = (metric_t) { "dictionary_size_bytes", GAUGE, f->word_size };
+    m[n++] = (metric_t) { "stack_peak_cells", GAUGE, s->stack_peak };
+    m[n++] = (metric_t) { "stack_size_cells", GAUGE, f->stack_size };
+    m[n++] = (metric_t) { "rstack_peak_cells", GAUGE, s->rstack_peak };
+    m[n++] = (metric_t) { "rstack_size_cells", GAUGE, f->rstack_size };
+    m[n++] = (metric_t) { "io_seconds", SECONDS, io };
+    m[n++] = (metric_t) { "run_seconds", SECONDS, elapsed - io };
+    return n;
+}
+
+// the value of m, in buf
+static void format_value(const metric_t* m, char* buf, size_t size)
+{
+    if(m->kind == SECONDS)
+	snprintf(buf, size, "%" PRIu64 ".%09" PRIu64, m->value / 1000000000, m->value % 1000000000);
+    else snprintf(buf, size, "%" PRIu64, m->value);
+}
+
+void write_stats(forth_t* f, int fd, int format)
+{
+    metric_t m[MAX_METRICS];
+    size_t n = collect(f, m);
+
+    char buf[4096];
+    size_t len = 0;
+    for(size_t i = 0 ; i < n ; ++i)
+    {
+	char value[32];
+	format_value(&m[i], value, sizeof(value));
+	if(format == STATS_JSON)
+	    len += snprintf(buf + len, sizeof(buf) - len, "%s\"%s\": %s",
+			    i ? ", " : "{", m[i].name, value);
+	else
+	{
+	    const char* total = m[i].kind == GAUGE ? "" : "_total";
+	    len += snprintf(buf + len, sizeof(buf) - len, "# TYPE forth_%s%s %s\nforth_%s%s %s\n",
+			    m[i].name, total, m[i].kind == GAUGE ? "gauge" : "counter",
+			    m[i].name, total, value);
+	}
+    }
+    if(format == STATS_JSON) len += snprintf(buf + len, sizeof(buf) - len, "}\n");
+
+    for(size_t done = 0 ; done < len ; )
+    {
+	ssize_t w = write(fd, buf + done, len - done);
+	if(w <= 0) return; // e.g. a closed pipe, the dump is dropped
+	done += w;
+    }
+}
+
+void stats_every(forth_t* f, int fd, int format, u64 ms)
+{
+    stats_t* s = &f->stats;
+    if(!s->timer)
+    {
+	catch_stats_signal();
+	timer_t* timer = malloc(sizeof(timer_t));
+	struct sigevent ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.sigev_notify = SIGEV_SIGNAL;
+	ev.sigev_signo = STATS_SIGNAL;
+	ev.sigev_value.sival_ptr = s;
+	if(timer_create(CLOCK_MONOTONIC, &ev, timer) < 0)
+	{
+	    free(timer);
+	    return; // no dumps then
+	}
+	s->timer = timer;
+    }
+
+    s->fd = ms ? fd : -1;
+    s->format = format;
+    s->due = 0;
+    struct timespec t = { ms / 1000, ms % 1000 * 1000000 };
+    struct itimerspec every = { t, t }; // all zeros disarm it
+    timer_settime(*cast(timer_t*, s->timer), 0, &every, NULL);
+}
+
+// write the periodic dump, if one is due
+void stats_tick(forth_t* f)
+{
+    stats_t* s = &f->stats;
+    if(!s->due) return;
+    s->due = 0;
+    if(s->fd >= 0) write_stats(f, s->fd, s->format);
+}
+
+void printstats(forth_t* f)
+{
+    metric_t m[MAX_METRICS];
+    size_t n = collect(f, m);
+    for(size_t i = 0 ; i < n ; ++i)
+    {
+	char value[32];
+	format_value(&m[i], value, sizeof(value));
+	print(f, "%-22s %s\n", m[i].name, value);
+    }
+}
+
+void dowrite_stats(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    int format = pop(f);
+    check(format == STATS_JSON || format == STATS_PROMETHEUS);
+    flush_output(f); // in case fd is the one of the output
+    write_stats(f, pop(f), format);
+}
+
+void dostats_every(forth_t* f)
+{
+    check(stack_size(f) >= 3);
+    u64 ms = pop(f);
+    int format = pop(f);
+    check(format == STATS_JSON || format == STATS_PROMETHEUS);
+    stats_every(f, pop(f), format, ms);
+}
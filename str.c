@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+/*
+  Strings are given as an address and a length, like the blocks of
+  mem.c (compare and search work on them too), and are never scanned
+  for a NUL: s" ..." pushes a literal one, parse-name the next token
+  and find-name looks one up (see forth.c). concat and number>s write
+  to a buffer given by the caller, slice only moves the address and
+  length.
+*/
+
+bool parse_literal(forth_t* f, const char* txt, size_t len, u64* value);
+u64 hash_name(const char* name, size_t len);
+
+// ( addr1 len1 addr2 len2 dst -- dst len ) the first string then the
+// second one, at dst (which may be addr1)
+void concat(forth_t* f)
+{
+    check(stack_size(f) >= 5);
+    u8* dst = cast(u8*, pop(f));
+    u64 len2 = pop(f);
+    u8* p2 = cast(u8*, pop(f));
+    u64 len1 = pop(f);
+    u8* p1 = cast(u8*, pop(f));
+
+    memmove(dst + len1, p2, len2);
+    memmove(dst, p1, len1);
+    push(f, cast(u64, dst));
+    push(f, len1 + len2);
+}
+
+// ( addr len start n -- addr' len' ) the n chars from start, or up to
+// the end if there are fewer
+void slice(forth_t* f)
+{
+    check(stack_size(f) >= 4);
+    u64 n = pop(f);
+    u64 start = pop(f);
+    u64 len = f->top_stack[-1];
+    if(start > len) start = len;
+    if(n > len - start) n = len - start;
+    f->top_stack[-2] += start;
+    f->top_stack[-1] = n;
+}
+
+// ( addr len -- h ) FNV-1a, as for the names of the dictionary
+void dohash(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64 len = pop(f);
+    f->top_stack[-1] = hash_name(cast(const char*, f->top_stack[-1]), len);
+}
+
+// ( addr len -- x flag ) the number the interpreter reads (in base, or
+// a double with a . or an exponent), flag 0 and x 0 if none
+void to_number(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64 len = pop(f);
+    const char* txt = cast(const char*, pop(f));
+
+    u64 value;
+    if(!parse_literal(f, txt, len, &value))
+    {
+	push(f, 0);
+	push(f, 0);
+	return;
+    }
+    push(f, value);
+    push(f, 1);
+}
+
+// ( n dst -- dst len ) n in base at dst, at most 65 chars
+void number_to_s(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    char* dst = cast(char*, pop(f));
+    i64 n = cast(i64, pop(f));
+    u64 base = f->radix;
+    check(base >= 2 && base <= 36);
+
+    // digits from the end of tmp, as a u64 so that the minimum negates
+    char tmp[65];
+    char* p = tmp + sizeof tmp;
+    u64 u = n < 0 ? -cast(u64, n) : cast(u64, n);
+    do *--p = "0123456789abcdefghijklmnopqrstuvwxyz"[u % base]; while(u /= base);
+    if(n < 0) *--p = '-';
+
+    size_t len = tmp + sizeof tmp - p;
+    memcpy(dst, p, len);
+    push(f, cast(u64, dst));
+    push(f, len);
+}
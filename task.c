@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "forth.h"
+
+#define check(cond) forth_check(cond) // see forth.h
+
+/*
+  Tasks: spawn ( x1 .. xn n xt -- task ) runs xt on the stack x1 .. xn
+  on a pool of worker threads, and join ( task -- y1 .. ym ) waits for
+  it and pushes what it left on its stack (an error in the task is
+  raised again by join). Every task must be joined.
+
+  The pool of a forth is started by its first spawn, with f->workers
+  threads (one per CPU by default). Each worker runs its tasks on a
+  forth of its own, which shares the words of the spawning one like a
+  fork (see share_forth) but without freezing them: tasks only run
+  threads, so the spawning forth can go on defining words, as long as
+  tasks do not look words up meanwhile.
+
+  Each worker has a deque of tasks: the tasks spawned by a task go to
+  the bottom of the deque of its worker, which takes its own tasks
+  from the bottom (the newest first) and steals from the top of the
+  deques of the others (the oldest first) when it has none. The tasks
+  spawned outside of the pool are dealt to the workers in turn. A
+  worker waiting in join runs other tasks meanwhile, on top of the
+  stacks of the task that joins.
+
+  A task waiting on a channel (see chan.c) runs queued tasks too, as
+  the other side may be one of them, but each on a coroutine of the
+  worker (see coro_call): that one may well wait on the task in turn,
+  which it could not do on top of its stacks. A worker runs its
+  coroutines, if any, in place of sleeping until a task is queued or
+  done. When a task waiting on a channel is about to sleep, it calls
+  block_pool, which starts one more worker if tasks were queued
+  meanwhile and no worker is idle to run them, up to MAX_WORKERS in
+  all.
+*/
+
+#define MAX_WORKERS 1024
+
+enum { TASK_PENDING, TASK_DONE, TASK_FAILED };
+
+typedef struct task_t
+{
+    u64* xt;
+    u64* values; // its arguments, then its results
+    size_t count;
+    int state;
+} task_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    task_t** tasks; // ring of cap slots, the top one at head
+    size_t head;
+    size_t count;
+    size_t cap;
+} deque_t;
+
+typedef struct
+{
+    struct pool_t* pool;
+    size_t index; // in the workers of pool
+    forth_t* f;
+    deque_t deque;
+    pthread_t thread;
+} worker_t;
+
+typedef struct pool_t
+{
+    forth_t* owner; // which spawned first
+    worker_t** workers; // of MAX_WORKERS, workers[n] on are not started
+    size_t n;
+    size_t first; // started with the pool
+    size_t turn; // next worker to get a task spawned outside the pool
+
+    pthread_mutex_t lock;
+    pthread_cond_t work; // a task was queued
+    pthread_cond_t done; // a task finished
+    size_t queued; // tasks in the deques
+    size_t idle; // workers waiting for work
+    bool stop;
+} pool_t;
+
+forth_t* share_forth(forth_t* base);
+void coro_call(forth_t* f, void (*fn)(forth_t*, void*), void* arg);
+bool coro_yield(forth_t* f);
+bool coro_others(forth_t* f);
+
+static __thread worker_t* self; // running on this thread, if any
+
+static void deque_push(deque_t* d, task_t* t)
+{
+    pthread_mutex_lock(&d->lock);
+    if(d->count == d->cap)
+    {
+	size_t cap = d->cap ? 2 * d->cap : 64;
+	task_t** tasks = malloc(cap * sizeof(task_t*));
+	for(size_t i = 0 ; i < d->count ; ++i) tasks[i] = d->tasks[(d->head + i) % d->cap];
+	free(d->tasks);
+	d->tasks = tasks;
+	d->head = 0;
+	d->cap = cap;
+    }
+    d->tasks[(d->head + d->count++) % d->cap] = t;
+    pthread_mutex_unlock(&d->lock);
+}
+
+// from the bottom if own, else from the top
+static task_t* deque_take(deque_t* d, bool own)
+{
+    task_t* t = NULL;
+    pthread_mutex_lock(&d->lock);
+    if(d->count > 0 && own) t = d->tasks[(d->head + --d->count) % d->cap];
+    else if(d->count > 0)
+    {
+	t = d->tasks[d->head];
+	d->head = (d->head + 1) % d->cap;
+	d->count--;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+// a task for w (NULL outside of the pool) to run, or NULL if none
+static task_t* find_task(pool_t* p, worker_t* w)
+{
+    task_t* t = w ? deque_take(&w->deque, true) : NULL;
+    size_t n = __atomic_load_n(&p->n, __ATOMIC_ACQUIRE);
+    size_t start = w ? w->index : 0;
+    for(size_t i = 1 ; !t && i <= n ; ++i)
+	t = deque_take(&p->workers[(start + i) % n]->deque, false);
+
+    if(t)
+    {
+	pthread_mutex_lock(&p->lock);
+	p->queued--;
+	pthread_mutex_unlock(&p->lock);
+    }
+    return t;
+}
+
+// run t on the stacks of f, above what they hold
+static void run_task(pool_t* p, forth_t* f, task_t* t)
+{
+    u64* base = f->top_stack;
+    u64* rbase = f->top_rstack;
+    u64* next = f->next;
+    u64* current = f->current;
+    jmp_buf env;
+    jmp_buf* outer = f->on_error;
+    volatile int state = TASK_DONE;
+
+    f->on_error = &env;
+    if(setjmp(env) == 0)
+    {
+	for(size_t i = 0 ; i < t->count ; ++i) push(f, t->values[i]);
+	run_codeword(f, t->xt);
+    }
+    else state = TASK_FAILED;
+    f->on_error = outer;
+
+    free(t->values);
+    t->values = NULL;
+    t->count = 0;
+    if(f->top_stack < base) state = TASK_FAILED; // took more than given
+    if(state == TASK_DONE)
+    {
+	t->count = f->top_stack - base;
+	t->values = malloc(t->count * sizeof(u64) + 1);
+	memcpy(t->values, base, t->count * sizeof(u64));
+    }
+    f->top_stack = base;
+    f->top_rstack = rbase;
+    f->state = NORMAL_STATE;
+    f->next = next;
+    f->current = current;
+    flush_output(f);
+
+    pthread_mutex_lock(&p->lock);
+    __atomic_store_n(&t->state, state, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&p->done);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// in place of a wait on the pool, while f runs coroutines: let them run
+static void run_coros(forth_t* f)
+{
+    if(coro_yield(f)) return;
+    struct timespec t = { 0, 50000 }; // they all wait for I/O
+    nanosleep(&t, NULL);
+}
+
+static void* work(void* arg)
+{
+    worker_t* w = arg;
+    pool_t* p = w->pool;
+    self = w;
+    while(true)
+    {
+	task_t* t = find_task(p, w);
+	if(t)
+	{
+	    run_task(p, w->f, t);
+	    continue;
+	}
+	if(coro_others(w->f))
+	{
+	    run_coros(w->f);
+	    continue;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->idle++;
+	while(p->queued == 0 && !p->stop) pthread_cond_wait(&p->work, &p->lock);
+	p->idle--;
+	bool stop = p->queued == 0;
+	pthread_mutex_unlock(&p->lock);
+	if(stop) return NULL;
+    }
+}
+
+static worker_t* new_worker(pool_t* p, size_t index)
+{
+    worker_t* w = calloc(1, sizeof(worker_t));
+    w->pool = p;
+    w->index = index;
+    w->f = share_forth(p->owner);
+    w->f->pool = p;
+    pthread_mutex_init(&w->deque.lock, NULL);
+    return w;
+}
+
+static pool_t* get_pool(forth_t* f)
+{
+    if(f->pool) return f->pool;
+
+    pool_t* p = calloc(1, sizeof(pool_t));
+    p->owner = f;
+    p->n = f->workers ? f->workers : sysconf(_SC_NPROCESSORS_ONLN);
+    if(p->n < 1) p->n = 1;
+    if(p->n > MAX_WORKERS) p->n = MAX_WORKERS;
+    p->first = p->n;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    p->workers = calloc(MAX_WORKERS, sizeof(worker_t*));
+    for(size_t i = 0 ; i < p->n ; ++i) p->workers[i] = new_worker(p, i);
+    for(size_t i = 0 ; i < p->n ; ++i)
+	pthread_create(&p->workers[i]->thread, NULL, work, p->workers[i]);
+
+    f->pool = p;
+    return p;
+}
+
+// f, running a task, is about to wait for another forth
+void block_pool(forth_t* f)
+{
+    pool_t* p = f->pool;
+    if(!p || !self || self->pool != p) return;
+
+    pthread_mutex_lock(&p->lock);
+    if(p->queued > 0 && p->idle == 0 && p->n < MAX_WORKERS && !p->stop)
+    {
+	worker_t* w = p->workers[p->n] = new_worker(p, p->n);
+	if(pthread_create(&w->thread, NULL, work, w) == 0)
+	    __atomic_store_n(&p->n, p->n + 1, __ATOMIC_RELEASE);
+	else
+	{
+	    free_forth(w->f);
+	    pthread_mutex_destroy(&w->deque.lock);
+	    free(w);
+	    p->workers[p->n] = NULL;
+	}
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+// by free_forth, for the forth that started the pool
+void free_pool(forth_t* f)
+{
+    pool_t* p = f->pool;
+    if(!p || p->owner != f) return;
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    for(size_t i = 0 ; i < p->n ; ++i) pthread_join(p->workers[i]->thread, NULL);
+    for(size_t i = 0 ; i < p->n ; ++i)
+    {
+	worker_t* w = p->workers[i];
+	free_forth(w->f);
+	pthread_mutex_destroy(&w->deque.lock);
+	free(w->deque.tasks);
+	free(w);
+    }
+    free(p->workers);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->done);
+    free(p);
+    f->pool = NULL;
+}
+
+void spawn(forth_t* f)
+{
+    check(stack_size(f) >= 2);
+    u64* xt = cast(u64*, pop(f));
+    u64 n = pop(f);
+    check(stack_size(f) >= n);
+    pool_t* p = get_pool(f);
+
+    task_t* t = malloc(sizeof(task_t));
+    t->xt = xt;
+    t->count = n;
+    t->values = malloc(n * sizeof(u64) + 1);
+    memcpy(t->values, f->top_stack - n, n * sizeof(u64));
+    f->top_stack -= n;
+    t->state = TASK_PENDING;
+
+    worker_t* w = self && self->pool == p ? self : p->workers[p->turn++ % p->first];
+    deque_push(&w->deque, t);
+
+    pthread_mutex_lock(&p->lock);
+    p->queued++;
+    pthread_cond_signal(&p->work);
+    pthread_cond_broadcast(&p->done); // workers in join help too
+    pthread_mutex_unlock(&p->lock);
+
+    push(f, cast(u64, t));
+}
+
+// run one of the queued tasks on f, if f runs on a worker of its pool;
+// false if there was none
+bool help_pool(forth_t* f)
+{
+    pool_t* p = f->pool;
+    if(!p || !self || self->pool != p) return false;
+
+    task_t* t = find_task(p, self);
+    if(t) run_task(p, f, t);
+    return t != NULL;
+}
+
+static void run_coro_task(forth_t* f, void* t) { run_task(f->pool, f, t); }
+
+// the same, but on a coroutine of f, which runs from the next yield
+bool help_pool_later(forth_t* f)
+{
+    pool_t* p = f->pool;
+    if(!p || !self || self->pool != p) return false;
+
+    task_t* t = find_task(p, self);
+    if(t) coro_call(f, run_coro_task, t);
+    return t != NULL;
+}
+
+void join(forth_t* f)
+{
+    check(stack_size(f) >= 1);
+    task_t* t = cast(task_t*, pop(f));
+    pool_t* p = f->pool;
+    check(p);
+
+    while(__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) == TASK_PENDING)
+    {
+	if(help_pool(f)) continue;
+	if(coro_others(f))
+	{
+	    run_coros(f);
+	    continue;
+	}
+
+	// until a task is done or queued (see spawn), when there may be
+	// one to help with again
+	pthread_mutex_lock(&p->lock);
+	if(t->state == TASK_PENDING) pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+    }
+
+    int state = t->state;
+    check(state != TASK_DONE || stack_size(f) + t->count <= f->stack_size);
+    for(size_t i = 0 ; state == TASK_DONE && i < t->count ; ++i) push(f, t->values[i]);
+    free(t->values);
+    free(t);
+    if(state == TASK_FAILED) forth_error(f, "[task failed]");
+}
@@ -0,0 +1,8 @@
+# include through the cache of cache.args, that cache.before filled:
+# the words of cache.fs come from there (no calls to if, then and the
+# like compiling them), until the words before them differ
+.stats include tests/cache.fs .stats
+-5 sign 0 sign 7 sign 10 count-down .s drop drop drop drop
+: other ;
+.stats include tests/cache.fs .stats
+-5 sign 0 sign 7 sign 10 count-down .s
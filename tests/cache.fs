@@ -0,0 +1,4 @@
+# included by cache.f, a file that just defines words (so that include
+# caches them), with immediate words that run when it is compiled
+: sign dup 0 < if drop -1 else 0 > if 1 else 0 then then ;
+: count-down 0 swap begin dup while 1 - swap 1 + swap repeat drop ;
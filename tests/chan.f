@@ -0,0 +1,22 @@
+# channels of 1 cell between tasks, on 4 workers (see chan.args); an
+# mpmc one has 2 slots, see new_chan
+: c1 [ 1 chan-new word lit find-word code-word , , ] ;
+: c2 [ 1 chan-new-spsc word lit find-word code-word , , ] ;
+: produce 1000 begin dup while dup c1 chan-send 1 - repeat c1 chan-send ;
+: square begin c1 chan-recv dup while dup * c2 chan-send repeat c2 chan-send ;
+: consume 0 begin c2 chan-recv dup while + repeat drop ;
+: go 0 ' consume spawn 0 ' square spawn 0 ' produce spawn join join join ;
+go .s drop
+
+# the second send fills it, the second receive empties it
+1 chan-new dup 5 swap chan-send dup 6 swap chan-send
+dup chan-recv swap dup chan-recv swap chan-try-recv .s drop drop drop
+
+# chan-send-n and chan-recv-n, more cells than slots
+# (here is not the same for a task, hence a constant)
+: buf [ here @ 4096 + word lit find-word code-word , , ] ;
+: fillbuf 0 begin dup 100 < while dup dup 8 * buf + ! 1 + repeat drop ;
+: c3 [ 16 chan-new word lit find-word code-word , , ] ;
+: send-all buf 100 c3 chan-send-n ;
+: batch fillbuf 0 ' send-all spawn buf 800 + 100 c3 chan-recv-n join buf 800 + 99 8 * + @ buf 800 + @ ;
+batch .s
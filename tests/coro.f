@@ -0,0 +1,19 @@
+# a coroutine waiting on a channel lets the others run, the
+# interpreter too: the producer fills it while the interpreter waits
+: ch [ 4 chan-new word lit find-word code-word , , ] ;
+: produce 6 begin dup while dup ch chan-send 1 - repeat drop ;
+: recv3 ch chan-recv ch chan-recv ch chan-recv ;
+0 word produce find-word code-word task recv3 recv3 .s
+drop drop drop drop drop drop
+
+# coroutines with I/O: a server and a client on one thread, over a
+# socket, while the interpreter waits for both
+: buf [ here @ 4096 + word lit find-word code-word , , ] ;
+: sfd buf 200 + ;
+: cfd buf 208 + ;
+: port 47123 ;
+: lfd [ port tcp-listen word lit find-word code-word , , ] ;
+: serve lfd accept sfd ! buf 64 sfd @ read-async buf swap sfd @ write-async sfd @ close-fd ;
+: client s" 127.0.0.1" drop port tcp-connect cfd ! s" ping" cfd @ write-async drop buf 100 + 64 cfd @ read-async cfd @ close-fd ;
+0 word serve find-word code-word task client run-tasks .s
+buf 100 + c@ buf 103 + c@ .s
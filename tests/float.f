@@ -0,0 +1,17 @@
+# doubles: what reads as one, the words on them (f. prints one), and
+# the vector words on arrays of them
+1.5 f. -.25 f. 2.5e-1 f. 1e9 f. 1E3 f. 1e9 f>s .s drop
+2.25 1.5 f* f. 1 s>f 4 s>f f/ f. 2.0 fsqrt f. 7.9 f>s -7.9 f>s .s drop drop
+1.5 2.5 f< 2.5 1.5 f< 0.5 0.5 f= .s drop drop drop
+# in base 16, 1e9 is the integer $1e9
+hex 1e9 decimal .s drop
+
+# a b dst n v+ and v*, with a length that leaves a tail to the kernels
+: a [ here @ 4096 + word lit find-word code-word , , ] ;
+: b [ here @ 8192 + word lit find-word code-word , , ] ;
+: dst [ here @ 12288 + word lit find-word code-word , , ] ;
+: fill-a 0 begin dup 11 < while dup s>f over 8 * a + ! 1 + repeat drop ;
+: fill-b 0 begin dup 11 < while 2.0 over 8 * b + ! 1 + repeat drop ;
+fill-a fill-b
+a 11 vsum f. a b 11 vdot f.
+a b dst 11 v+ dst 11 vsum f. a b dst 11 v* dst 80 + @ f.
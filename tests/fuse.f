@@ -0,0 +1,15 @@
+# the superinstructions of fuse_thread: the cells of the threads it
+# leaves (cell n of w is the nth cell of its body), and what they do
+: cell word find-word code-word swap 8 * + @ ;
+: is word find-word code-word = ;
+: a 2 + 3 - ;
+: b swap drop ;
+: c over over ;
+: d dup if 1 then ;
+: down dup 0 = if exit then 1 - down ;
+1 cell a is lit+ 2 cell a 3 cell a is lit+ 4 cell a 5 cell a is exit .s
+drop drop drop drop drop
+1 cell b is nip 1 cell c is 2dup 1 cell d is dup0branch .s drop drop drop
+10 a 1 2 b 3 4 c 5 d 0 d .s drop drop drop drop drop drop drop drop drop
+# no return stack is left to the 1000000 calls of down but for tailcall
+1000000 down .s
@@ -0,0 +1,2 @@
+# run twice by hash.f, the second fork not seeing the x of the first
+x : x 3 ; x .s
@@ -0,0 +1,12 @@
+# lookups through the hash index: a redefinition hides the old word
+# from the words compiled after it only, and the forks of --batch (see
+# hash.args and hash.in) see the words of this file but not those of
+# each other
+: x 1 ;
+: y x ;
+: x 2 ;
+: z x ;
+y z x .s drop drop drop
+# names that differ in their last letter or length only
+: ab 3 ; : aa 4 ; : a 5 ; : abc 6 ;
+a aa ab abc .s drop drop drop drop
@@ -0,0 +1,7 @@
+# the words of image.fs, from an image that cannot be mapped where it
+# was saved from (see image-moved.args), hence relocated
+v @ 7 v ! v @ .s drop drop
+5 buf ! buf @ .s drop
+3 sq 4 twice 2 last-sq .s drop drop drop
+xt-sq word sq find-word code-word = .s drop
+to-ten greet nip greet drop c@ .s
@@ -0,0 +1,14 @@
+# the words saved to the images of image.f and image-moved.f (see
+# their .before), with pointers to the dictionary that the threads do
+# not tell from numbers: a variable, the operand of a lit (past here),
+# and a codeword compiled with ,
+here @ 0 ,
+: v [ word lit find-word code-word , , ] ;
+42 v !
+: buf [ here @ 4096 + word lit find-word code-word , , ] ;
+: sq dup * ;
+: twice [ word dup find-word code-word , ] + ;
+: xt-sq ' sq ;
+: to-ten 0 begin dup 10 < while 1 + repeat ;
+: last-sq 1 + sq ;
+: greet s" hello" ;
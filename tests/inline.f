@@ -0,0 +1,5 @@
+# a recursive call is not inlined: the thread it would copy is not
+# done, and past here are the cells that fusing p left over
+: p 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + ;
+: r dup if 1 - r then ;
+5 r .s
@@ -0,0 +1,20 @@
+# read-async and write-async between coroutines over a socket
+: buf [ here @ 4096 + word lit find-word code-word , , ] ;
+: sfd buf 200 + ;
+: cfd buf 208 + ;
+: got buf 216 + ;
+: big buf 4096 + ;
+: port 47124 ;
+: lfd [ port tcp-listen word lit find-word code-word , , ] ;
+: connect s" 127.0.0.1" drop port tcp-connect cfd ! ;
+
+# a length past 32 bits reads what there is
+: serve lfd accept sfd ! buf 4294967297 sfd @ read-async got ! sfd @ close-fd ;
+: client connect s" ping" cfd @ write-async cfd @ close-fd ;
+0 word serve find-word code-word task client run-tasks got @ .s drop drop
+
+# more than the socket takes at once, written all, read in parts
+: serve-all lfd accept sfd ! 0 got ! begin got @ 1048576 < while
+  big 65536 sfd @ read-async got @ + got ! repeat sfd @ close-fd ;
+: client-all connect big 1048576 cfd @ write-async cfd @ close-fd ;
+0 word serve-all find-word code-word task client-all run-tasks got @ .s
@@ -0,0 +1,14 @@
+# numbers in base (2 to 36), with the $ % 0x 0b prefixes, and past 64
+# bits (where they wrap, like the arithmetic)
+2 base ! 101 -1111 decimal .s drop drop
+8 base ! 777 decimal 36 base ! zz ZZ -z10 decimal .s drop drop drop drop
+hex ff -$ff decimal $ff %1010 -%11 0xff 0b101 .s drop drop drop drop drop drop drop
+# in base 36, a token that names a word is the word
+36 base ! 1 dup drop decimal .s drop
+# invalid digits, and a prefix alone
+2 base ! s" 102" s>number decimal s" $" s>number s" 0x" s>number s" 12x" s>number .s
+drop drop drop drop drop drop drop drop
+# the 8 digit steps and the one digit ones wrap alike
+12345678901234567 123456789012345678901 .s drop drop
+18446744073709551617 -9223372036854775808 9223372036854775808 .s drop drop drop
+hex 10000000000000001 decimal 2 base ! 10000000000000000000000000000000000000000000000000000000000000011 decimal .s
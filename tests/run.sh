@@ -0,0 +1,38 @@
+#!/bin/sh
+# usage: tests/run.sh dir [test...]
+#
+# Run each test (tests/NAME.f) on the engines of dir (ENGINES, default:
+# every one), and compare its output with tests/NAME.expected. The
+# options of tests/NAME.args, if any, come before the file, and the
+# sed script tests/NAME.sed, if any, edits the output first. The shell
+# commands of tests/NAME.before, if any, run first, with $engine the
+# engine and $tmp a new directory (which the options may name too).
+# The standard input is tests/NAME.in if there is one, else empty.
+# Prints the ones that differ, and fails if any does.
+
+dir=$1
+shift
+ENGINES=${ENGINES:-"forth forth-switch forth-direct forth-fast forth-jit forth-prof"}
+if [ $# -eq 0 ]; then
+    set -- $(for t in tests/*.f; do basename "$t" .f; done)
+fi
+
+status=0
+for t in "$@"; do
+    sed=tests/$t.sed
+    [ -f "$sed" ] || sed=/dev/null
+    in=tests/$t.in
+    [ -f "$in" ] || in=/dev/null
+    for e in $ENGINES; do
+	engine=$dir/$e
+	tmp=$(mktemp -d)
+	[ -f "tests/$t.before" ] && . "./tests/$t.before"
+	eval "args=\"$(cat "tests/$t.args" 2>/dev/null)\""
+	if ! "$engine" $args "tests/$t.f" < "$in" 2>&1 | sed -f "$sed" | cmp -s - "tests/$t.expected"; then
+	    echo "$t: $e: failed"
+	    status=1
+	fi
+	rm -rf "$tmp"
+    done
+done
+exit $status
@@ -0,0 +1,3 @@
+# run by stack.f: twenty needs the room for 20 cells of the 30 (see
+# stack.args), and stops before pushing any
+1 2 3 4 5 6 7 8 9 10 1 2 3 4 5 6 7 8 9 10 .s twenty
@@ -0,0 +1,2 @@
+# run by stack.f: add3 takes 3 cells, and stops before adding any
+1 2 add3 .s
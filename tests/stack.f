@@ -0,0 +1,15 @@
+# the stack effects of colon definitions, checked on entry: the words
+# of this file run with what they take, and the forks of --batch (see
+# stack.args and stack.in) enter them without it, or without the room
+# for what they push
+: sq dup * ;
+: add3 + + ;
+: top 1 2 add3 ;
+: ten 1 2 3 4 5 6 7 8 9 10 ;
+: twenty ten ten ;
+: sgn dup 0 < if drop -1 else 0 > if 1 else 0 then then ;
+3 sq 4 5 6 add3 .s drop drop
+4 5 6 add3 top .s drop
+-3 sgn 0 sgn 3 sgn .s drop drop drop
+# all 30 cells
+ten twenty .s
@@ -0,0 +1,9 @@
+# the metrics, as JSON then for Prometheus (see stats.sed for the ones
+# that differ between engines, or runs)
+: a 1 2 3 drop drop drop ;
+: b a a ;
+b 1 0 stats-write 1 1 stats-write
+
+# a peak within a word, of a known stack effect
+: c 1 2 3 4 5 6 7 8 9 10 drop drop drop drop drop drop drop drop drop drop ;
+c .stats
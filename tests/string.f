@@ -0,0 +1,21 @@
+# strings (an address and a length), from s" in a definition and at
+# the top level, and the words that work on them
+: hello s" hello" ;
+: world s"  world" ;
+: buf [ here @ 4096 + word lit find-word code-word , , ] ;
+hello type world type s"  and more!" type 10 emit
+hello nip s" " nip s" a string longer than a cell" nip .s drop drop drop
+
+# concat at buf, then at the end of itself
+hello world buf concat type 10 emit
+hello world buf concat s" !" buf concat type 10 emit
+# slice, within the string and past its end
+hello world buf concat 6 5 slice type 10 emit
+hello 3 10 slice type 10 emit hello 9 1 slice nip .s drop
+
+# compare, search, hash and the numbers
+hello hello compare hello world compare world hello compare .s drop drop drop
+hello world buf concat s" wor" search nip nip hello s" xy" search nip nip .s drop drop
+hello hash s" hello" hash = hello hash world hash = .s drop drop
+s" -123" s>number s" 12ab" s>number .s drop drop drop drop
+-4567 buf number>s type 10 emit
@@ -0,0 +1,16 @@
+# spawn and join on 4 workers (see task.args): tasks spawned by tasks,
+# joined by them, and what tasks leave coming back in order
+: sum 0 begin over while over + swap 1 - swap repeat nip ;
+: three 1 2 3 ;
+: leaves 0 ' three spawn join ;
+: half 1 ' sum spawn ;
+: quarters 1000 half 2000 half 3000 half 4000 half join swap join + swap join + swap join + ;
+: tree 0 ' quarters spawn 0 ' quarters spawn join swap join ;
+leaves .s drop drop drop
+tree .s drop drop
+
+# more tasks than workers, each joined by the interpreter
+: left [ here @ 4096 + word lit find-word code-word , , ] ;
+: many 0 begin dup 100 < while dup 1 ' sum spawn swap 1 + repeat drop ;
+: joins join 99 left ! begin left @ while swap join + left @ 1 - left ! repeat ;
+many joins .s